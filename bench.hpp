@@ -0,0 +1,81 @@
+#pragma once
+
+#include "head.hpp"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+// fast_rand is a per-thread xorshift generator, cheap enough to sit inside
+// benchmark loops (gen_random reseeds from time() on every call).
+inline uint32_t fast_rand()
+{
+    static thread_local uint32_t state = 0;
+    if (state == 0)
+    {
+        state = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1U;
+    }
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// run_threads starts `count` threads running func(index), releases them at
+// the same time and returns the wall time until the last one finished.
+template<typename F>
+std::chrono::nanoseconds run_threads(int count, F func)
+{
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < count; ++i)
+    {
+        threads.emplace_back([&ready, &go, &func, i]() {
+            ready++;
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            func(i);
+        });
+    }
+
+    while (ready.load() < count)
+    {
+        std::this_thread::yield();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+    return std::chrono::steady_clock::now() - start;
+}
+
+// mops converts an operation count and elapsed time to million ops / second.
+inline double mops(int64_t ops, std::chrono::nanoseconds elapsed)
+{
+    if (elapsed.count() <= 0)
+    {
+        return 0;
+    }
+    return static_cast<double>(ops) * 1000.0 / static_cast<double>(elapsed.count());
+}
+
+// percentile returns the p-th percentile (0..100) of the samples, sorting
+// them in place.
+template<typename T>
+T percentile(std::vector<T>& samples, double p)
+{
+    if (samples.empty())
+    {
+        return T();
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t pos = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[std::min(pos, samples.size() - 1)];
+}
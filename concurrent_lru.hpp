@@ -0,0 +1,559 @@
+#pragma once
+
+#include "head.hpp"
+#include "bench.hpp"
+#include "epoch.hpp"
+#include "lru.hpp"
+#include "sharded_lru.hpp"
+
+/// <summary>
+/// ConcurrentLruCache is a cache for read-mostly data whose Get and Peek
+/// never lock: the index is a hash table of atomic bucket chains, readers
+/// walk it inside an EpochGuard, and writers, serialised by one mutex,
+/// publish new nodes with release stores and retire unlinked ones to the
+/// EpochDomain. A node is never modified once published except for its
+/// access time and CLOCK reference bit, so a Set replaces the whole node.
+/// Recency is approximate: readers set the reference bit, evictions sweep
+/// the writer-side list CLOCK-style. TTLs expire like LruCache's, through
+/// an ExpiryWheel reaped by writes and ReapExpired.
+/// </summary>
+/// <typeparam name="key_t"></typeparam>
+/// <typeparam name="value_t"></typeparam>
+template<typename key_t, typename value_t>
+class ConcurrentLruCache : public Noncopyable
+{
+public:
+    using entry_t = entry<key_t, value_t>;
+
+private:
+    struct node
+    {
+        entry_t entry_;
+        std::atomic<node*> next_{nullptr}; // bucket chain, read by readers
+        uint64_t hash_;
+        node* newer_{nullptr}; // recency list, writers only
+        node* older_{nullptr};
+
+        node(key_t&& key, value_t&& value, std::chrono::seconds ttl, std::chrono::system_clock::time_point now,
+            uint64_t hash)
+            : entry_(std::move(key), std::move(value), ttl, now)
+            , hash_(hash)
+        {
+        }
+    };
+
+    struct table
+    {
+        std::size_t mask_;
+        std::unique_ptr<std::atomic<node*>[]> buckets_;
+
+        explicit table(std::size_t size)
+            : mask_(size - 1)
+            , buckets_(new std::atomic<node*>[size])
+        {
+            for (std::size_t i = 0; i < size; ++i)
+                buckets_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+    std::atomic<table*> table_;
+    std::atomic<int64_t> size_{0};
+    int64_t capacity_;
+    std::chrono::seconds ttl_;
+    key_hash<key_t> hasher_;
+
+    std::mutex mutex_;         // writers
+    node* newest_{nullptr};    // recency list, CLOCK hand at the oldest end
+    node* oldest_{nullptr};
+    ExpiryWheel<key_t> wheel_; // expiry records of the entries with a TTL
+    size_t reap_budget_{8};
+
+public:
+    ConcurrentLruCache(int64_t capacity, std::chrono::seconds ttl = std::chrono::seconds(-1))
+        : table_(new table(bucket_count(capacity)))
+        , capacity_(capacity)
+        , ttl_(ttl)
+    {
+    }
+
+    // The cache must not be read while it is destroyed; nodes already
+    // retired belong to the EpochDomain.
+    ~ConcurrentLruCache()
+    {
+        for (node* n = newest_; n != nullptr;)
+        {
+            node* older = n->older_;
+            delete n;
+            n = older;
+        }
+        delete table_.load();
+    }
+
+    // Get returns a value from the cache and marks the entry as recently
+    // used. It takes no lock.
+    template<typename K>
+    bool Get(const K& key, value_t& value)
+    {
+        EpochGuard guard;
+
+        node* n = find(key, hasher_(key));
+        if (n == nullptr)
+        {
+            return false;
+        }
+
+        // entries without a TTL need neither the clock nor an access time
+        if (n->entry_.ttl_.count() >= 0)
+        {
+            auto now = std::chrono::system_clock::now();
+            if (n->entry_.expired(now))
+            {
+                return false;
+            }
+            n->entry_.touch(now, std::chrono::milliseconds(1));
+        }
+
+        if (!n->entry_.referenced_.load())
+        {
+            n->entry_.referenced_ = true;
+        }
+        value = n->entry_.value_;
+        return true;
+    }
+
+    // Peek returns a value from the cache without marking it. It takes no
+    // lock.
+    template<typename K>
+    bool Peek(const K& key, value_t& value)
+    {
+        EpochGuard guard;
+
+        node* n = find(key, hasher_(key));
+        if (n == nullptr || n->entry_.expired())
+        {
+            return false;
+        }
+
+        value = n->entry_.value_;
+        return true;
+    }
+
+    // IsExist check whether a value is existed in the cache and not expired.
+    template<typename K>
+    bool IsExist(const K& key)
+    {
+        EpochGuard guard;
+
+        node* n = find(key, hasher_(key));
+        return n != nullptr && !n->entry_.expired();
+    }
+
+    // SetWithTTL sets a value in the cache with a TTL.
+    void SetWithTTL(key_t key, value_t value, std::chrono::seconds ttl)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto now = std::chrono::system_clock::now();
+        reap(now, reap_budget_);
+        set_value(std::move(key), std::move(value), ttl, now);
+    }
+
+    // Set sets a value in the cache with the default TTL.
+    void Set(key_t key, value_t value)
+    {
+        SetWithTTL(std::move(key), std::move(value), ttl_);
+    }
+
+    // Delete deletes an item from the cache.
+    template<typename K>
+    bool Delete(const K& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::atomic<node*>* link = locate(key, hasher_(key));
+        node* n = link->load(std::memory_order_relaxed);
+        if (n == nullptr)
+        {
+            return false;
+        }
+
+        remove(link, n);
+        return true;
+    }
+
+    // Clear will clear the entire cache.
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        table* old = table_.load(std::memory_order_relaxed);
+        table_.store(new table(old->mask_ + 1), std::memory_order_release);
+        retire_all(old);
+        wheel_.Clear();
+    }
+
+    // Length returns how many elements are in the cache
+    int64_t Length()
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    // Capacity returns the cache maximum capacity.
+    int64_t Capacity()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacity_;
+    }
+
+    // ReapExpired removes expired entries, looking at no more than `budget`
+    // expiry records, see LruCache::ReapExpired.
+    size_t ReapExpired(size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return reap(std::chrono::system_clock::now(), budget);
+    }
+
+    // SetReapBudget sets how many expiry records each write may reap.
+    void SetReapBudget(size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reap_budget_ = budget;
+    }
+
+    // SetCapacity will set the capacity of the cache, evicting entries if
+    // it shrinks. A capacity beyond the hash table's size rebuilds the table
+    // with copies of the nodes.
+    void SetCapacity(int64_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        check_capacity();
+
+        table* old = table_.load(std::memory_order_relaxed);
+        if (bucket_count(capacity) > old->mask_ + 1)
+            rebuild(bucket_count(capacity));
+    }
+
+private:
+    // one bucket per entry, the chains stay short without ever resizing
+    static std::size_t bucket_count(int64_t capacity)
+    {
+        std::size_t size = 16;
+        while (static_cast<int64_t>(size) < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    template<typename K>
+    node* find(const K& key, uint64_t hash) const
+    {
+        table* t = table_.load(std::memory_order_acquire);
+        node* n = t->buckets_[mix_hash(hash) & t->mask_].load(std::memory_order_acquire);
+        while (n != nullptr && !(n->hash_ == hash && n->entry_.key_ == key))
+        {
+            n = n->next_.load(std::memory_order_acquire);
+        }
+        return n;
+    }
+
+    // locate returns the link pointing at key's node, or the null link ending
+    // its chain. Writers only.
+    template<typename K>
+    std::atomic<node*>* locate(const K& key, uint64_t hash)
+    {
+        table* t = table_.load(std::memory_order_relaxed);
+        std::atomic<node*>* link = &t->buckets_[mix_hash(hash) & t->mask_];
+        for (node* n = link->load(std::memory_order_relaxed); n != nullptr; n = link->load(std::memory_order_relaxed))
+        {
+            if (n->hash_ == hash && n->entry_.key_ == key)
+                break;
+            link = &n->next_;
+        }
+        return link;
+    }
+
+    void set_value(key_t&& key, value_t&& value, std::chrono::seconds ttl, std::chrono::system_clock::time_point now)
+    {
+        const uint64_t hash = hasher_(key);
+        std::atomic<node*>* link = locate(key, hash);
+        node* old = link->load(std::memory_order_relaxed);
+
+        node* n = new node(std::move(key), std::move(value), ttl, now, hash);
+        schedule(n->entry_);
+        if (old != nullptr)
+        {
+            // readers see either node whole
+            n->next_.store(old->next_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            link->store(n, std::memory_order_release);
+            unlink(old);
+            EpochDomain::Instance().Retire(old);
+        }
+        else
+        {
+            table* t = table_.load(std::memory_order_relaxed);
+            std::atomic<node*>& bucket = t->buckets_[mix_hash(hash) & t->mask_];
+            n->next_.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(n, std::memory_order_release);
+            size_++;
+        }
+        link_newest(n);
+        check_capacity();
+    }
+
+    // remove unlinks a node from its chain and the recency list and retires
+    // it; `link` points at it.
+    void remove(std::atomic<node*>* link, node* n)
+    {
+        link->store(n->next_.load(std::memory_order_relaxed), std::memory_order_release);
+        unlink(n);
+        size_--;
+        EpochDomain::Instance().Retire(n);
+    }
+
+    // check_capacity evicts CLOCK-style from the oldest end: a referenced
+    // node loses its bit and moves to the newest end.
+    void check_capacity()
+    {
+        while (size_.load(std::memory_order_relaxed) > capacity_ && oldest_ != nullptr)
+        {
+            node* victim = oldest_;
+            if (victim->entry_.referenced_.load() && victim != newest_)
+            {
+                victim->entry_.referenced_ = false;
+                unlink(victim);
+                link_newest(victim);
+                continue;
+            }
+            remove(locate(victim->entry_.key_, victim->hash_), victim);
+        }
+    }
+
+    void schedule(entry_t& e)
+    {
+        int64_t tick = e.deadline_tick();
+        if (tick < 0 || (e.wheel_id_ != 0 && e.wheel_tick_ <= tick))
+            return;
+
+        e.wheel_id_ = wheel_.Schedule(e.key_, tick);
+        e.wheel_tick_ = tick;
+    }
+
+    size_t reap(std::chrono::system_clock::time_point now, size_t budget)
+    {
+        auto visit = [this, now](const key_t& key, uint32_t id) -> int64_t {
+            std::atomic<node*>* link = locate(key, hasher_(key));
+            node* n = link->load(std::memory_order_relaxed);
+            if (n == nullptr || n->entry_.wheel_id_ != id)
+                return -1; // deleted or replaced since
+
+            if (n->entry_.expired(now))
+            {
+                remove(link, n);
+                return -1;
+            }
+
+            // a sliding TTL moved the deadline
+            n->entry_.wheel_tick_ = n->entry_.deadline_tick();
+            if (n->entry_.wheel_tick_ < 0)
+                n->entry_.wheel_id_ = 0;
+            return n->entry_.wheel_tick_;
+        };
+        return wheel_.Advance(ExpiryWheel<key_t>::Tick(now), budget, visit);
+    }
+
+    // rebuild moves the entries to a larger table. Chains cannot be
+    // relinked under readers, so every node is copied and the old ones are
+    // retired with the old table.
+    void rebuild(std::size_t size)
+    {
+        table* old = table_.load(std::memory_order_relaxed);
+        table* t = new table(size);
+        node* newest = nullptr;
+        node* oldest = nullptr;
+        for (node* n = oldest_; n != nullptr; n = n->newer_)
+        {
+            key_t key = n->entry_.key_;
+            value_t value = n->entry_.value_;
+            node* copy = new node(std::move(key), std::move(value), n->entry_.ttl_, n->entry_.access_time_.load(),
+                n->hash_);
+            copy->entry_.write_time_ = n->entry_.write_time_;
+            copy->entry_.referenced_ = n->entry_.referenced_.load();
+            copy->entry_.wheel_id_ = n->entry_.wheel_id_;
+            copy->entry_.wheel_tick_ = n->entry_.wheel_tick_;
+
+            std::atomic<node*>& bucket = t->buckets_[mix_hash(n->hash_) & t->mask_];
+            copy->next_.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(copy, std::memory_order_relaxed);
+
+            copy->older_ = newest;
+            if (newest != nullptr)
+                newest->newer_ = copy;
+            newest = copy;
+            if (oldest == nullptr)
+                oldest = copy;
+        }
+
+        const int64_t size_before = size_.load(std::memory_order_relaxed);
+        table_.store(t, std::memory_order_release);
+        retire_all(old);
+        newest_ = newest;
+        oldest_ = oldest;
+        size_.store(size_before, std::memory_order_relaxed);
+    }
+
+    // retire_all retires an unpublished table with every listed node.
+    void retire_all(table* old)
+    {
+        for (node* n = newest_; n != nullptr;)
+        {
+            node* older = n->older_;
+            EpochDomain::Instance().Retire(n);
+            n = older;
+        }
+        EpochDomain::Instance().Retire(old);
+        newest_ = oldest_ = nullptr;
+        size_.store(0, std::memory_order_relaxed);
+    }
+
+    void link_newest(node* n)
+    {
+        n->newer_ = nullptr;
+        n->older_ = newest_;
+        if (newest_ != nullptr)
+            newest_->newer_ = n;
+        newest_ = n;
+        if (oldest_ == nullptr)
+            oldest_ = n;
+    }
+
+    void unlink(node* n)
+    {
+        if (n->newer_ != nullptr)
+            n->newer_->older_ = n->older_;
+        else
+            newest_ = n->older_;
+        if (n->older_ != nullptr)
+            n->older_->newer_ = n->newer_;
+        else
+            oldest_ = n->newer_;
+        n->newer_ = n->older_ = nullptr;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////
+void concurrent_lru_test()
+{
+    int res = 0;
+    ConcurrentLruCache<int, int> cache(100, std::chrono::seconds(60));
+    std::cout << "-------------------concurrent LRU cache---------------------" << std::endl;
+    for (int i = 0; i < 150; ++i)
+    {
+        cache.Set(i, i * 10);
+    }
+    std::cout << "length = " << cache.Length() << ", get(149) = " << cache.Get(149, res) << " - " << res
+              << ", delete 149 : " << cache.Delete(149) << ", item 149 is exist : " << cache.IsExist(149)
+              << std::endl;
+
+    // stress: readers check every value they see against its key while
+    // writers replace, delete and expire entries and the capacity moves
+    ConcurrentLruCache<int, int64_t> stress(1000);
+    const int key_space = 4000;
+    std::atomic<bool> done{false};
+    std::atomic<int64_t> reads{0};
+    std::atomic<int64_t> torn{0};
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; ++w)
+    {
+        writers.emplace_back([&stress, &done, w]() {
+            for (int64_t version = 0; !done.load(); ++version)
+            {
+                int key = static_cast<int>(fast_rand() % key_space);
+                uint32_t op = fast_rand() % 100;
+                if (op < 70)
+                    stress.Set(key, int64_t(key) << 32 | version);
+                else if (op < 85)
+                    stress.SetWithTTL(key, int64_t(key) << 32 | version, std::chrono::seconds(0));
+                else if (op < 99)
+                    stress.Delete(key);
+                else if (w == 0)
+                    stress.SetCapacity(500 + fast_rand() % 2000);
+                else
+                    stress.ReapExpired(64);
+            }
+        });
+    }
+    run_threads(4, [&](int) {
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+        int64_t value = 0;
+        int64_t n = 0;
+        while (std::chrono::steady_clock::now() < end)
+        {
+            int key = static_cast<int>(fast_rand() % key_space);
+            if ((n++ & 1) ? stress.Get(key, value) : stress.Peek(key, value))
+                torn += (value >> 32) != key ? 1 : 0;
+        }
+        reads += n;
+    });
+    done = true;
+    for (auto& th : writers)
+    {
+        th.join();
+    }
+    std::cout << "stress : reads = " << reads << ", torn values = " << torn
+              << ", length <= capacity : " << (stress.Length() <= stress.Capacity()) << std::endl;
+}
+
+// read_mostly_throughput runs Gets with one Set in `write_every` operations
+// over `key_space` keys and returns the aggregate throughput in Mops/s.
+template<typename cache_t>
+double read_mostly_throughput(cache_t& cache, int threads, int ops_per_thread, int key_space, uint32_t write_every)
+{
+    for (int i = 0; i < key_space; ++i)
+    {
+        cache.Set(i, i);
+    }
+
+    auto elapsed = run_threads(threads, [&cache, ops_per_thread, key_space, write_every](int) {
+        int value = 0;
+        for (int i = 0; i < ops_per_thread; ++i)
+        {
+            uint32_t r = fast_rand();
+            int key = static_cast<int>(r % key_space);
+            if (fast_rand() % write_every == 0)
+            {
+                cache.Set(key, key);
+            }
+            else
+            {
+                cache.Get(key, value);
+            }
+        }
+    });
+    return mops(static_cast<int64_t>(threads) * ops_per_thread, elapsed);
+}
+
+// concurrent_lru_bench scales a 99.9% read workload from 1 to 64 threads
+// over the lock-free cache, the shared-lock CLOCK cache and the sharded one,
+// all with the same capacity, twice the key space as in sharded_lru_bench.
+void concurrent_lru_bench()
+{
+    std::cout << "-------------------read-mostly cache bench, 0.1% writes (Mops/s)---------------------" << std::endl;
+    const int key_space = 1 << 16;
+    const int capacity = key_space * 2;
+    const int ops = 200000;
+
+    int counts[] = {1, 2, 4, 8, 16, 32, 64};
+    for (int threads : counts)
+    {
+        ConcurrentLruCache<int, int> concurrent(capacity);
+        LruCache<int, int, slab_storage, clock_policy> clock(capacity);
+        ShardedLruCache<int, int, 64> sharded(capacity);
+        double a = read_mostly_throughput(concurrent, threads, ops, key_space, 1000);
+        double b = read_mostly_throughput(clock, threads, ops, key_space, 1000);
+        double c = read_mostly_throughput(sharded, threads, ops, key_space, 1000);
+        std::cout << "threads = " << threads << "\tConcurrentLruCache = " << a << "\tLruCache<CLOCK> = " << b
+                  << "\tShardedLruCache<64> = " << c << std::endl;
+    }
+}
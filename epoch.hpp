@@ -0,0 +1,197 @@
+#pragma once
+
+#include "head.hpp"
+#include "singleton.hpp"
+
+/// <summary>
+/// EpochDomain is epoch-based reclamation for lock-free readers. A reader
+/// pins the current epoch for the duration of a lookup (EpochGuard); a
+/// writer that unlinks an object retires it with the epoch of the moment,
+/// and the object is freed once the global epoch has moved two steps past
+/// it, when no reader pinned before the unlink can still hold it.
+///
+/// Pinning is a load and an exchange, readers never wait. The epoch only
+/// advances when every pinned thread has seen the current one, so a reader
+/// stuck inside a guard delays reclamation, not other threads.
+/// Threads take one of max_threads slots on first use and give it back on
+/// exit. There is one domain per process, Instance().
+/// </summary>
+class EpochDomain : public Noncopyable
+{
+public:
+    static const int max_threads = 1024;
+
+private:
+    struct alignas(64) slot
+    {
+        std::atomic<uint64_t> epoch_{0}; // epoch << 1 | 1 while pinned, 0 otherwise
+        std::atomic<bool> used_{false};
+    };
+
+    struct retired
+    {
+        uint64_t epoch_;
+        void* object_;
+        void (*free_)(void*);
+    };
+
+    // thread_slot is the calling thread's slot, released on thread exit.
+    struct thread_slot
+    {
+        slot* slot_{nullptr};
+        int depth_{0}; // nested guards, only the outermost pins
+
+        ~thread_slot()
+        {
+            if (slot_ != nullptr)
+            {
+                slot_->epoch_.store(0, std::memory_order_release);
+                slot_->used_.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<uint64_t> epoch_{1};
+    slot slots_[max_threads];
+    std::atomic<int> high_water_{0}; // slots at and above are unused
+
+    std::mutex retired_mutex_;
+    std::vector<retired> retired_;
+    size_t retires_since_advance_{0};
+
+public:
+    static EpochDomain& Instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    ~EpochDomain()
+    {
+        for (auto& r : retired_)
+        {
+            r.free_(r.object_);
+        }
+    }
+
+    // Pin marks the calling thread as reading from the current epoch.
+    void Pin()
+    {
+        thread_slot& ts = local();
+        if (ts.depth_++ > 0)
+            return;
+
+        // a full barrier: the slot is visible before the first pointer load
+        uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+        ts.slot_->epoch_.exchange(epoch << 1 | 1, std::memory_order_seq_cst);
+    }
+
+    void Unpin()
+    {
+        thread_slot& ts = local();
+        if (--ts.depth_ == 0)
+            ts.slot_->epoch_.store(0, std::memory_order_release);
+    }
+
+    // Retire frees `object` with `free` once no reader can reach it. The
+    // object must already be unlinked from everything readers traverse.
+    template<typename T>
+    void Retire(T* object, void (*free)(void*) = [](void* p) { delete static_cast<T*>(p); })
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        retired_.push_back({epoch_.load(std::memory_order_seq_cst), object, free});
+        if (++retires_since_advance_ >= 64)
+        {
+            retires_since_advance_ = 0;
+            advance();
+        }
+    }
+
+    // Reclaim tries to advance the epoch and frees what it can, for
+    // writers that have gone quiet.
+    void Reclaim()
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        advance();
+    }
+
+    // Pending returns how many retired objects are waiting to be freed.
+    size_t Pending()
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        return retired_.size();
+    }
+
+private:
+    EpochDomain() = default;
+
+    thread_slot& local()
+    {
+        static thread_local thread_slot ts;
+        if (ts.slot_ == nullptr)
+            ts.slot_ = acquire_slot();
+        return ts;
+    }
+
+    slot* acquire_slot()
+    {
+        for (int i = 0; i < max_threads; ++i)
+        {
+            bool expected = false;
+            if (!slots_[i].used_.load(std::memory_order_relaxed) &&
+                slots_[i].used_.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+            {
+                int high = high_water_.load();
+                while (high < i + 1 && !high_water_.compare_exchange_weak(high, i + 1))
+                {
+                }
+                return &slots_[i];
+            }
+        }
+        throw std::runtime_error("EpochDomain: too many threads");
+    }
+
+    // advance moves the epoch on if every pinned thread is in the current
+    // one, then frees the objects retired two epochs ago. Called with
+    // retired_mutex_ held.
+    void advance()
+    {
+        uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+        const int high = high_water_.load(std::memory_order_acquire);
+        bool quiet = true;
+        for (int i = 0; i < high && quiet; ++i)
+        {
+            uint64_t pinned = slots_[i].epoch_.load(std::memory_order_seq_cst);
+            quiet = (pinned & 1) == 0 || (pinned >> 1) == epoch;
+        }
+        if (quiet)
+        {
+            epoch_.store(++epoch, std::memory_order_seq_cst);
+        }
+
+        auto keep = std::partition(retired_.begin(), retired_.end(),
+            [epoch](const retired& r) { return r.epoch_ + 2 > epoch; });
+        for (auto iter = keep; iter != retired_.end(); ++iter)
+        {
+            iter->free_(iter->object_);
+        }
+        retired_.erase(keep, retired_.end());
+    }
+};
+
+const int EpochDomain::max_threads;
+
+// EpochGuard pins the epoch for its lifetime.
+class EpochGuard : public Noncopyable
+{
+public:
+    EpochGuard()
+    {
+        EpochDomain::Instance().Pin();
+    }
+
+    ~EpochGuard()
+    {
+        EpochDomain::Instance().Unpin();
+    }
+};
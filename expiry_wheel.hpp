@@ -0,0 +1,203 @@
+#pragma once
+
+#include "head.hpp"
+#include "singleton.hpp"
+
+/// <summary>
+/// ExpiryWheel buckets expiry records by deadline, one slot per second. A
+/// record is (key, id, tick): the cache keeps the id of the entry's live
+/// record, so records of deleted or replaced entries are recognised and
+/// dropped. Deadlines are rescheduled lazily: an access that extends a
+/// sliding TTL does not touch the wheel, the record is moved when its slot
+/// comes up and the entry turns out to still be alive.
+/// </summary>
+template<typename key_t>
+class ExpiryWheel
+{
+private:
+    static const int64_t slots = 256; // ticks further away wait for more rounds
+
+    struct record_t
+    {
+        key_t key_;
+        uint32_t id_;
+        int64_t tick_;
+    };
+
+    std::vector<std::vector<record_t>> slots_;
+    int64_t cursor_;     // next tick to process
+    size_t read_{0};     // progress inside the cursor slot
+    size_t write_{0};    // retained records of the cursor slot
+    uint32_t next_id_{0};
+    size_t size_{0};
+
+public:
+    ExpiryWheel()
+        : slots_(slots)
+        , cursor_(Tick(std::chrono::system_clock::now()))
+    {
+    }
+
+    // Tick converts a time point to whole seconds, rounding down.
+    static int64_t Tick(std::chrono::system_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+    }
+
+    // Schedule adds a record due at `tick` and returns its id (never zero).
+    uint32_t Schedule(const key_t& key, int64_t tick)
+    {
+        if (++next_id_ == 0)
+            ++next_id_;
+
+        // the cursor slot may be half processed, anything due earlier goes
+        // to the cursor itself.
+        if (tick < cursor_)
+            tick = cursor_;
+
+        slots_[tick & (slots - 1)].push_back(record_t{key, next_id_, tick});
+        size_++;
+        return next_id_;
+    }
+
+    // Advance processes at most `budget` records due up to `now_tick` and
+    // returns how many it looked at; less than budget means caught up.
+    // visit(key, id) returns the tick to reschedule the record at, or a
+    // negative value to drop it.
+    template<typename F>
+    size_t Advance(int64_t now_tick, size_t budget, F visit)
+    {
+        // far behind: every slot due in the last rotation covers all of them
+        if (read_ == 0 && now_tick - cursor_ >= slots)
+            cursor_ = now_tick - slots + 1;
+
+        size_t processed = 0;
+        while (processed < budget && cursor_ <= now_tick)
+        {
+            auto& slot = slots_[cursor_ & (slots - 1)];
+            while (read_ < slot.size() && processed < budget)
+            {
+                record_t record = std::move(slot[read_++]);
+                processed++;
+
+                if (record.tick_ > cursor_)
+                {
+                    slot[write_++] = std::move(record); // due in a later round
+                    continue;
+                }
+
+                size_--;
+                int64_t tick = visit(record.key_, record.id_);
+                if (tick >= 0)
+                {
+                    record.tick_ = tick < cursor_ + 1 ? cursor_ + 1 : tick;
+                    slots_[record.tick_ & (slots - 1)].push_back(std::move(record));
+                    size_++;
+                }
+            }
+
+            if (read_ < slot.size())
+                break;
+
+            slot.erase(slot.begin() + write_, slot.end());
+            read_ = write_ = 0;
+            cursor_++;
+        }
+        return processed;
+    }
+
+    // Size returns the number of pending records, stale ones included.
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    void Clear()
+    {
+        for (auto& slot : slots_)
+            slot.clear();
+        read_ = write_ = 0;
+        size_ = 0;
+    }
+};
+
+template<typename key_t>
+const int64_t ExpiryWheel<key_t>::slots;
+
+/// <summary>
+/// ExpirySweeper is a background thread that reaps expired entries of the
+/// caches it watches. Each round calls cache.ReapExpired(budget) until the
+/// cache reports it has caught up, so a cache lock is never held for more
+/// than `budget` records at a time.
+/// </summary>
+class ExpirySweeper : public Noncopyable
+{
+private:
+    std::vector<std::function<size_t(size_t)>> targets_;
+    std::chrono::milliseconds interval_;
+    size_t budget_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_{false};
+    std::thread thread_;
+
+public:
+    ExpirySweeper(std::chrono::milliseconds interval = std::chrono::milliseconds(1000), size_t budget = 256)
+        : interval_(interval)
+        , budget_(budget)
+    {
+    }
+
+    ~ExpirySweeper()
+    {
+        Stop();
+    }
+
+    // Watch adds a cache, it must outlive the sweeper or Stop().
+    template<typename cache_t>
+    void Watch(cache_t& cache)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        targets_.push_back([&cache](size_t budget) { return cache.ReapExpired(budget); });
+    }
+
+    void Start()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (thread_.joinable())
+            return;
+
+        stop_ = false;
+        thread_ = std::thread(&ExpirySweeper::run, this);
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!cond_.wait_for(lock, interval_, [this] { return stop_; }))
+        {
+            auto targets = targets_;
+            lock.unlock();
+            for (auto& reap : targets)
+            {
+                while (reap(budget_) >= budget_)
+                {
+                }
+            }
+            lock.lock();
+        }
+    }
+};
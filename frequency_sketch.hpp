@@ -0,0 +1,110 @@
+#pragma once
+
+#include "head.hpp"
+
+/// <summary>
+/// frequency_sketch is a count-min sketch estimating how often a key was
+/// seen recently. Each key maps to four 4-bit counters packed sixteen to a
+/// 64-bit word, and the estimate is the smallest of them, so a sketch for n
+/// entries takes about 8n bytes whatever the key type. Once 10n increments
+/// have been counted every counter is halved: old popularity fades and the
+/// sketch follows a shifting working set.
+/// </summary>
+class frequency_sketch
+{
+private:
+    static const int rows = 4;
+    static const uint64_t max_count = 15;
+
+    std::vector<uint64_t> table_;
+    uint64_t mask_{0};        // word count - 1
+    int64_t additions_{0};    // increments since the last halving
+    int64_t sample_size_{0};  // increments between halvings
+
+public:
+    // reserve sizes the sketch for `capacity` entries. Resizing forgets
+    // everything counted so far.
+    void reserve(std::size_t capacity)
+    {
+        std::size_t words = 16;
+        while (words < capacity)
+        {
+            words <<= 1;
+        }
+
+        table_.assign(words, 0);
+        mask_ = words - 1;
+        additions_ = 0;
+        sample_size_ = static_cast<int64_t>(words) * 10;
+    }
+
+    // capacity returns how many entries the sketch is sized for.
+    std::size_t capacity() const
+    {
+        return table_.size();
+    }
+
+    // frequency returns the estimated count of `hash`, 0..15.
+    int frequency(uint64_t hash) const
+    {
+        if (table_.empty())
+            return 0;
+
+        uint64_t count = max_count;
+        for (int i = 0; i < rows; ++i)
+        {
+            uint64_t word = 0;
+            int shift = 0;
+            locate(hash, i, word, shift);
+            count = std::min(count, (table_[word] >> shift) & max_count);
+        }
+        return static_cast<int>(count);
+    }
+
+    // increment counts one occurrence of `hash`.
+    void increment(uint64_t hash)
+    {
+        if (table_.empty())
+            return;
+
+        bool added = false;
+        for (int i = 0; i < rows; ++i)
+        {
+            uint64_t word = 0;
+            int shift = 0;
+            locate(hash, i, word, shift);
+            if (((table_[word] >> shift) & max_count) < max_count)
+            {
+                table_[word] += uint64_t(1) << shift;
+                added = true;
+            }
+        }
+
+        if (added && ++additions_ >= sample_size_)
+        {
+            age();
+        }
+    }
+
+private:
+    // locate picks the word and the nibble of row i's counter.
+    void locate(uint64_t hash, int row, uint64_t& word, int& shift) const
+    {
+        const uint64_t h = mix_hash(hash + static_cast<uint64_t>(row + 1) * 0x9E3779B97F4A7C15ULL);
+        word = h & mask_;
+        shift = static_cast<int>(h >> 60) * 4;
+    }
+
+    // age halves every counter.
+    void age()
+    {
+        for (auto& word : table_)
+        {
+            word = (word >> 1) & 0x7777777777777777ULL;
+        }
+        additions_ /= 2;
+    }
+};
+
+const int frequency_sketch::rows;
+const uint64_t frequency_sketch::max_count;
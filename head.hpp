@@ -2,7 +2,11 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <iostream>
 #include <list>
 #include <set>
@@ -18,6 +22,7 @@
 #include <iostream>
 #include <list>
 #include <mutex>
+#include <condition_variable>
 #include <unordered_map>
 #include <thread>
 
@@ -29,6 +34,31 @@ int gen_random(int MIN, int MAX)
     return (rand() % (MAX - MIN)) + MIN;
 }
 
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+// mix_hash is the murmur3 64-bit finalizer. std::hash is the identity for
+// integers, so hashes are mixed before they pick a bucket or a shard.
+inline uint64_t mix_hash(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// cpu_relax tells the CPU the thread is spinning on a shared word, so it
+// backs off instead of hammering the cache line.
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
 void swap(std::vector<int>& src, int i, int j)
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "head.hpp"
+
+#include <new>
+#include <type_traits>
+
+template<typename Signature, std::size_t Capacity = 48>
+class inline_function;
+
+/// <summary>
+/// inline_function is a move-only std::function that keeps callables of up
+/// to Capacity bytes inside the object, so building, moving and destroying
+/// one does not allocate. A bigger callable still works but goes to the
+/// heap, like it would with std::function.
+/// </summary>
+template<typename R, typename... Args, std::size_t Capacity>
+class inline_function<R(Args...), Capacity>
+{
+private:
+    struct ops
+    {
+        R (*invoke_)(void* storage, Args&&... args);
+        void (*move_)(void* from, void* to); // move-constructs into `to`, destroys `from`
+        void (*destroy_)(void* storage);
+    };
+
+    template<typename F>
+    static constexpr bool fits()
+    {
+        return sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<F>::value;
+    }
+
+    // inline_ops runs a callable stored in the buffer itself.
+    template<typename F>
+    struct inline_ops
+    {
+        static R invoke(void* storage, Args&&... args)
+        {
+            return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+        }
+
+        static void move(void* from, void* to)
+        {
+            new (to) F(std::move(*static_cast<F*>(from)));
+            static_cast<F*>(from)->~F();
+        }
+
+        static void destroy(void* storage)
+        {
+            static_cast<F*>(storage)->~F();
+        }
+
+        static constexpr ops table = {&invoke, &move, &destroy};
+    };
+
+    // heap_ops runs a callable too big for the buffer, which holds a pointer.
+    template<typename F>
+    struct heap_ops
+    {
+        static R invoke(void* storage, Args&&... args)
+        {
+            return (**static_cast<F**>(storage))(std::forward<Args>(args)...);
+        }
+
+        static void move(void* from, void* to)
+        {
+            *static_cast<F**>(to) = *static_cast<F**>(from);
+        }
+
+        static void destroy(void* storage)
+        {
+            delete *static_cast<F**>(storage);
+        }
+
+        static constexpr ops table = {&invoke, &move, &destroy};
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+    const ops* ops_{nullptr};
+
+public:
+    inline_function() = default;
+
+    inline_function(std::nullptr_t)
+    {
+    }
+
+    template<typename F, typename = typename std::enable_if<
+                             !std::is_same<typename std::decay<F>::type, inline_function>::value>::type>
+    inline_function(F&& callable)
+    {
+        using callable_t = typename std::decay<F>::type;
+        if constexpr (fits<callable_t>())
+        {
+            new (storage_) callable_t(std::forward<F>(callable));
+            ops_ = &inline_ops<callable_t>::table;
+        }
+        else
+        {
+            static_assert(sizeof(callable_t*) <= Capacity, "inline_function: Capacity too small");
+            *reinterpret_cast<callable_t**>(storage_) = new callable_t(std::forward<F>(callable));
+            ops_ = &heap_ops<callable_t>::table;
+        }
+    }
+
+    inline_function(inline_function&& other) noexcept
+    {
+        if (other.ops_ != nullptr)
+        {
+            other.ops_->move_(other.storage_, storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    inline_function& operator=(inline_function&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.ops_ != nullptr)
+            {
+                other.ops_->move_(other.storage_, storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    inline_function& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    inline_function(const inline_function&) = delete;
+    inline_function& operator=(const inline_function&) = delete;
+
+    ~inline_function()
+    {
+        reset();
+    }
+
+    R operator()(Args... args) const
+    {
+        if (ops_ == nullptr)
+            throw std::bad_function_call();
+
+        return ops_->invoke_(const_cast<unsigned char*>(storage_), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const
+    {
+        return ops_ != nullptr;
+    }
+
+    bool operator==(std::nullptr_t) const
+    {
+        return ops_ == nullptr;
+    }
+
+    bool operator!=(std::nullptr_t) const
+    {
+        return ops_ != nullptr;
+    }
+
+    void reset()
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy_(storage_);
+            ops_ = nullptr;
+        }
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "head.hpp"
+#include "thread_pool.hpp"
 
 void build_next_table(char* target, int* next_table)
 {
@@ -42,19 +43,10 @@ void build_next_table(char* target, int* next_table)
     }
 }
 
-int kmp(char* src, char* target)
+// kmp_search returns where target first starts in src[0, src_size), or -1,
+// with the next table built for target.
+int kmp_search(const char* src, int src_size, const char* target, int target_size, const int* next)
 {
-    int src_size = strlen(src);
-    int target_size = strlen(target);
-
-    if ((target + src_size) == 0 || target_size > src_size)
-    {
-        return -1;
-    }
-
-    int* next = new int[target_size];
-    build_next_table(target, next);
-
     int target_pos = 0;
     for (int i = 0; i < src_size;)
     {
@@ -77,15 +69,72 @@ int kmp(char* src, char* target)
 
         if (target_pos == target_size)
         {
-            delete[] next;
             return i - target_pos;
         }
     }
 
-    delete[] next;
     return -1;
 }
 
+int kmp(char* src, char* target)
+{
+    int src_size = strlen(src);
+    int target_size = strlen(target);
+
+    if ((target + src_size) == 0 || target_size > src_size)
+    {
+        return -1;
+    }
+
+    int* next = new int[target_size];
+    build_next_table(target, next);
+
+    int pos = kmp_search(src, src_size, target, target_size, next);
+    delete[] next;
+    return pos;
+}
+
+// parallel_kmp is kmp over chunks of `grain` start positions on the pool.
+// Every chunk also reads the target_size - 1 characters after it, so a
+// match across a chunk border is found by the chunk it starts in, and the
+// first match is the smallest found. Chunks starting after a match already
+// found are skipped.
+int parallel_kmp(ThreadPool& pool, char* src, char* target, int grain = 1 << 16)
+{
+    int src_size = strlen(src);
+    int target_size = strlen(target);
+
+    if (target_size == 0 || target_size > src_size)
+    {
+        return -1;
+    }
+
+    std::vector<int> next(target_size);
+    build_next_table(target, next.data());
+
+    const std::size_t starts = src_size - target_size + 1;
+    std::atomic<int> first{src_size};
+    return parallel_reduce(
+        pool, 0, starts, grain, -1,
+        [&](std::size_t begin, std::size_t end) {
+            if (static_cast<int>(begin) > first.load(std::memory_order_relaxed))
+                return -1;
+
+            const int size = static_cast<int>(end - begin) + target_size - 1;
+            int pos = kmp_search(src + begin, size, target, target_size, next.data());
+            if (pos < 0)
+                return -1;
+
+            pos += static_cast<int>(begin);
+            int seen = first.load(std::memory_order_relaxed);
+            while (pos < seen && !first.compare_exchange_weak(seen, pos, std::memory_order_relaxed))
+            {
+            }
+            return pos;
+        },
+        [](int a, int b) { return a < 0 ? b : (b < 0 ? a : std::min(a, b)); });
+}
+
 ////////////////////////////////////////
 ////////////////////////////////////////
 void kmp_test()
@@ -95,4 +144,42 @@ void kmp_test()
     char src[] = "xx--abababca";
     char target[] = "abababca";
     std::cout << "kmp result = " << kmp(src, target) << std::endl;
+
+    // a match across the border of two chunks
+    std::string text(1 << 20, 'x');
+    text.replace(3 * (1 << 16) - 3, 8, target);
+    ThreadPool pool(4);
+    std::cout << "kmp 1MB = " << kmp(&text[0], target) << ", parallel_kmp 1MB = " << parallel_kmp(pool, &text[0], target)
+              << std::endl;
+}
+
+// parallel_kmp_bench looks for a pattern found only at the end of 64MB of
+// text with kmp and with parallel_kmp on pools of 1 to 2x the CPUs.
+void parallel_kmp_bench()
+{
+    std::cout << "-------------------parallel_kmp scaling (64MB)---------------------" << std::endl;
+    char target[] = "abababca";
+    std::string text(64 << 20, 'a');
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+        text[i] = "ab"[fast_rand() % 2];
+    }
+    text.replace(text.size() - 8, 8, target);
+
+    auto start = std::chrono::steady_clock::now();
+    int pos = kmp(&text[0], target);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "kmp = " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms";
+
+    const int cpus = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int threads = 1; threads <= 2 * cpus; threads *= 2)
+    {
+        ThreadPool pool(threads);
+        start = std::chrono::steady_clock::now();
+        int parallel_pos = parallel_kmp(pool, &text[0], target);
+        elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "\t" << threads << "t = " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+                  << "ms" << (parallel_pos == pos ? "" : " (mismatch)");
+    }
+    std::cout << std::endl;
 }
@@ -1,6 +1,91 @@
 #pragma once
 
 #include "head.hpp"
+#include "bench.hpp"
+#include "expiry_wheel.hpp"
+#include "lru_policy.hpp"
+#include "lru_storage.hpp"
+#include "shared_mutex.hpp"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+#include <future>
+
+// relaxed_atomic is a copyable std::atomic with relaxed ordering, for entry
+// fields that hits update while holding only the shared lock.
+template<typename T>
+class relaxed_atomic
+{
+private:
+    std::atomic<T> value_;
+
+public:
+    relaxed_atomic(T value = T())
+        : value_(value)
+    {
+    }
+
+    relaxed_atomic(const relaxed_atomic& other)
+        : value_(other.load())
+    {
+    }
+
+    relaxed_atomic& operator=(const relaxed_atomic& other)
+    {
+        store(other.load());
+        return *this;
+    }
+
+    relaxed_atomic& operator=(T value)
+    {
+        store(value);
+        return *this;
+    }
+
+    operator T() const
+    {
+        return load();
+    }
+
+    T load() const
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+    void store(T value)
+    {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    T fetch_add(T delta)
+    {
+        return value_.fetch_add(delta, std::memory_order_relaxed);
+    }
+};
+
+// Sizers compute the cost an entry is charged against the cache capacity.
+// unit_sizer charges one per entry, so the capacity is an entry count;
+// size_sizer charges value.size(), so a cache of strings or byte vectors
+// gets a byte budget. Any functor `int64_t operator()(const value_t&)` will
+// do for values that know their own footprint.
+struct unit_sizer
+{
+    template<typename value_t>
+    int64_t operator()(const value_t&) const
+    {
+        return 1;
+    }
+};
+
+struct size_sizer
+{
+    template<typename value_t>
+    int64_t operator()(const value_t& value) const
+    {
+        return static_cast<int64_t>(value.size());
+    }
+};
 
 template<typename key_t, typename value_t>
 class entry
@@ -9,36 +94,70 @@ public:
     key_t key_;
     value_t value_;
     std::chrono::seconds ttl_;
-    std::chrono::system_clock::time_point access_time_;
+    relaxed_atomic<std::chrono::system_clock::time_point> access_time_;
+    std::chrono::system_clock::time_point write_time_; // when value_ was set
+    int64_t cost_{1};                        // charged against the capacity
+    relaxed_atomic<bool> referenced_{false}; // CLOCK reference bit
+    int64_t wheel_tick_{-1};                 // tick of the live expiry record
+    uint32_t wheel_id_{0};                   // id of the live expiry record, 0 if none
+    relaxed_atomic<int32_t> pins_{0};        // Pinned handles, value_ is read-only while set
+    bool detached_{false};                   // out of the cache, freed by the last unpin
 
-    entry(key_t key, value_t value, std::chrono::seconds ttl, std::chrono::system_clock::time_point access_time)
-        : key_(key)
-        , value_(value)
+    entry(key_t&& key, value_t&& value, std::chrono::seconds ttl, std::chrono::system_clock::time_point access_time)
+        : key_(std::move(key))
+        , value_(std::move(value))
         , ttl_(ttl)
         , access_time_(access_time)
+        , write_time_(access_time)
     {
     }
 
     entry(key_t key, value_t value, std::chrono::system_clock::time_point access_time)
-        : key_(key)
-        , value_(value)
+        : key_(std::move(key))
+        , value_(std::move(value))
         , ttl_(ttl_)
         , access_time_(access_time)
+        , write_time_(access_time)
     {
     }
 
     entry(key_t key, value_t value, std::chrono::seconds ttl)
-        : key_(key)
-        , value_(value)
+        : key_(std::move(key))
+        , value_(std::move(value))
         , ttl_(ttl)
         , access_time_(std::chrono::system_clock::now())
+        , write_time_(access_time_.load())
     {
     }
 
+    // deadline_tick returns the first wheel tick at which the entry is
+    // expired, or -1 if it never expires.
+    int64_t deadline_tick() const
+    {
+        if (ttl_.count() < 0)
+            return -1;
+
+        // expired once more than ttl_ whole seconds have passed; the tick
+        // after the deadline's is never early.
+        return ExpiryWheel<key_t>::Tick(access_time_.load() + ttl_ + std::chrono::seconds(1)) + 1;
+    }
+
     bool expired(std::chrono::system_clock::time_point now = std::chrono::system_clock::now())
     {
         return (ttl_.count() >= 0) &&
-               (std::chrono::duration_cast<std::chrono::seconds>(now - access_time_).count() > ttl_.count());
+               (std::chrono::duration_cast<std::chrono::seconds>(now - access_time_.load()).count() > ttl_.count());
+    }
+
+    // touch refreshes the access time. Refreshes closer than `resolution` to
+    // the stored time are skipped, so concurrent hits on a hot entry do not
+    // keep writing its cache line (expiry is checked in whole seconds).
+    void touch(std::chrono::system_clock::time_point now,
+        std::chrono::nanoseconds resolution = std::chrono::nanoseconds::zero())
+    {
+        if (resolution.count() == 0 || now - access_time_.load() >= resolution)
+        {
+            access_time_ = now;
+        }
     }
 };
 
@@ -47,95 +166,293 @@ public:
 /// </summary>
 /// <typeparam name="key_t"></typeparam>
 /// <typeparam name="value_t"></typeparam>
-template<typename key_t, typename value_t>
+/// <typeparam name="storage_t">storage engine, list_storage or slab_storage</typeparam>
+/// <typeparam name="policy_t">eviction policy: lru_policy, clock_policy, tinylfu_policy, two_queue_policy,
+/// arc_policy or lfu_policy</typeparam>
+/// <typeparam name="sizer_t">cost of a value, unit_sizer makes the capacity an entry count</typeparam>
+template<typename key_t, typename value_t, template<typename, typename> class storage_t = list_storage,
+    template<typename> class policy_t = lru_policy, typename sizer_t = unit_sizer>
 class LruCache
 {
 public:
     using entry_t = entry<key_t, value_t>;
-    using list_iterator_t = typename std::list<entry_t>::iterator;
+    using storage_type = storage_t<key_t, entry_t>;
+    using policy_type = policy_t<storage_type>;
+    using handle_t = typename storage_type::handle_t;
+
+    // Pinned reads a cached value in place. The entry stays alive while the
+    // handle does, even once evicted, replaced or deleted: a pinned value is
+    // never written, a Set of its key moves to a new entry. Detached entries
+    // no longer count against the capacity. A Pinned must not outlive its
+    // cache.
+    class Pinned
+    {
+    private:
+        LruCache* cache_{nullptr};
+        handle_t handle_{};
+        const value_t* value_{nullptr};
+
+    public:
+        Pinned() = default;
+
+        Pinned(LruCache* cache, handle_t handle, const value_t* value)
+            : cache_(cache)
+            , handle_(handle)
+            , value_(value)
+        {
+        }
+
+        Pinned(Pinned&& other) noexcept
+            : cache_(other.cache_)
+            , handle_(other.handle_)
+            , value_(other.value_)
+        {
+            other.cache_ = nullptr;
+            other.value_ = nullptr;
+        }
+
+        Pinned& operator=(Pinned&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                std::swap(cache_, other.cache_);
+                std::swap(handle_, other.handle_);
+                std::swap(value_, other.value_);
+            }
+            return *this;
+        }
+
+        Pinned(const Pinned&) = delete;
+        Pinned& operator=(const Pinned&) = delete;
+
+        ~Pinned()
+        {
+            reset();
+        }
+
+        explicit operator bool() const
+        {
+            return value_ != nullptr;
+        }
+
+        const value_t& operator*() const
+        {
+            return *value_;
+        }
+
+        const value_t* operator->() const
+        {
+            return value_;
+        }
+
+        // reset releases the entry.
+        void reset()
+        {
+            if (cache_ != nullptr)
+                cache_->unpin(handle_);
+            cache_ = nullptr;
+            value_ = nullptr;
+        }
+    };
 
 private:
-    int64_t size_{0};
+    int64_t size_{0}; // sum of the entries' costs
     int64_t capacity_;
-    std::mutex mutex_;
+    SharedMutex mutex_;
     std::chrono::seconds ttl_;
 
-    std::list<entry_t> entry_list_;                            // list store the real data
-    std::unordered_map<key_t, list_iterator_t> list_iter_map_; // map store the key-iter pair
+    storage_type entries_; // entries in LRU order, indexed by key
+    policy_type policy_;
+    sizer_t sizer_;
+
+    ExpiryWheel<key_t> wheel_; // expiry records of the entries with a TTL
+    size_t reap_budget_{8};    // wheel records each write may reap
+
+    std::mutex loads_mutex_;                                 // taken before mutex_, never after
+    std::unordered_map<key_t, std::shared_future<value_t>> loads_; // GetOrLoad loaders in flight
+    std::chrono::seconds refresh_ahead_{0};
+
+    cache_counters stats_; // atomics, no lock needed; Peek and IsExist are not counted
+
+    // GetOrLoad refresh-ahead reloads running in the background, under
+    // loads_mutex_. Declared last, so the destructor waits for them first.
+    std::list<std::future<void>> refreshes_;
 
 public:
     LruCache(int64_t capacity, std::chrono::seconds ttl = std::chrono::seconds(-1))
         : capacity_(capacity)
         , ttl_(ttl)
     {
+        // set_value inserts before it evicts, hence the extra slot. A cost
+        // budget says nothing about the entry count, let the storage grow.
+        if (std::is_same<sizer_t, unit_sizer>::value)
+            entries_.reserve(static_cast<std::size_t>(capacity > 0 ? capacity + 1 : 1));
     }
 
     // Get returns a value from the cache, and marks the entry as most recently
-    // used.
-    bool Get(key_t key, value_t& value)
+    // used. Under a policy with shared hits, concurrent Gets share the lock.
+    template<typename K>
+    bool Get(const K& key, value_t& value)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        sampled_timer timer(stats_.sample(true));
+        HitLock lock(mutex_, policy_type::shared_hits);
 
-        auto map_iter = list_iter_map_.find(key);
-        if (map_iter == list_iter_map_.end())
+        auto handle = entries_.find(key);
+        if (handle == entries_.end())
         {
+            stats_.add(cache_counters::misses);
             return false;
         }
 
-        auto now = std::chrono::system_clock::now();
-        if (map_iter->second->expired(now))
+        entry_t* e = hit(handle, std::chrono::system_clock::now());
+        if (e == nullptr)
         {
             return false;
         }
 
-        map_iter->second->access_time_ = now;
-        move_to_front(map_iter->second);
-
-        value = map_iter->second->value_;
+        value = e->value_;
         return true;
     }
 
+    // Pin returns a handle reading the value in place, empty on a miss. It
+    // is a hit like Get, without the copy.
+    template<typename K>
+    Pinned Pin(const K& key)
+    {
+        HitLock lock(mutex_, policy_type::shared_hits);
+
+        auto handle = entries_.find(key);
+        if (handle == entries_.end())
+        {
+            stats_.add(cache_counters::misses);
+            return Pinned();
+        }
+
+        entry_t* e = hit(handle, std::chrono::system_clock::now());
+        if (e == nullptr)
+        {
+            return Pinned();
+        }
+
+        e->pins_.fetch_add(1);
+        return Pinned(this, handle, &e->value_);
+    }
+
+    // MultiGet looks up keys[0..count) taking the lock once and reading the
+    // clock once. found[i] tells whether values[i] was filled; returns the
+    // number of hits.
+    size_t MultiGet(const key_t* keys, size_t count, value_t* values, bool* found)
+    {
+        return MultiGet(keys, nullptr, count, values, found);
+    }
+
+    // MultiGet over the positions index[0..count) of keys, values and found,
+    // so a caller can batch a subset of its keys without copying them.
+    size_t MultiGet(const key_t* keys, const uint32_t* index, size_t count, value_t* values, bool* found)
+    {
+        return multi_get(keys, index, count, [values, found](size_t pos, const entry_t* e) {
+            found[pos] = e != nullptr;
+            if (e != nullptr)
+                values[pos] = e->value_;
+        });
+    }
+
+    // MultiGet resizes values and found to keys.size().
+    size_t MultiGet(const std::vector<key_t>& keys, std::vector<value_t>& values, std::vector<bool>& found)
+    {
+        values.resize(keys.size());
+        found.assign(keys.size(), false);
+        return multi_get(keys.data(), nullptr, keys.size(), [&values, &found](size_t pos, const entry_t* e) {
+            if (e != nullptr)
+            {
+                found[pos] = true;
+                values[pos] = e->value_;
+            }
+        });
+    }
+
+    // GetOrLoad returns the cached value, or loads it with loader(key) and
+    // caches it with the default TTL. Concurrent callers missing the same key
+    // share a single load: one runs the loader, without holding the cache
+    // lock, and the others wait for its result, or its exception.
+    // With a refresh-ahead window, a hit on a value written more than
+    // ttl - window ago returns that value at once and reloads it in the
+    // background, as the key's single flight, so a miss meanwhile waits for
+    // the reload rather than starting another. The loader is copied for the
+    // reload. A failed refresh is counted in Stats().refresh_failures_, the
+    // old value stays until it expires.
+    template<typename F>
+    value_t GetOrLoad(const key_t& key, F loader)
+    {
+        value_t value;
+        bool stale = false;
+        if (get_for_load(key, value, stale))
+        {
+            if (stale)
+                refresh(key, loader);
+            return value;
+        }
+
+        load(key, loader, value);
+        return value;
+    }
+
+    // SetRefreshAhead sets the refresh-ahead window of GetOrLoad, zero (the
+    // default) turns it off.
+    void SetRefreshAhead(std::chrono::seconds window)
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+        refresh_ahead_ = window;
+    }
+
     // Peek returns a value from the cache without changing the LRU order.
-    bool Peek(key_t key, value_t& value)
+    template<typename K>
+    bool Peek(const K& key, value_t& value)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        SharedLock lock(mutex_);
 
-        auto map_iter = list_iter_map_.find(key);
-        if (map_iter == list_iter_map_.end())
+        auto handle = entries_.find(key);
+        if (handle == entries_.end())
         {
             return false;
         }
 
         auto now = std::chrono::system_clock::now();
-        if (map_iter->second->expired(now))
+        if (entries_.at(handle).expired(now))
         {
             return false;
         }
 
-        value = map_iter->second->value_;
+        value = entries_.at(handle).value_;
         return true;
     }
 
     // IsExisted check whether a value is existed in the cache and not expired.
-    bool IsExist(key_t key)
+    template<typename K>
+    bool IsExist(const K& key)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        SharedLock lock(mutex_);
 
-        auto map_iter = list_iter_map_.find(key);
-        if (map_iter == list_iter_map_.end())
+        auto handle = entries_.find(key);
+        if (handle == entries_.end())
         {
             return false;
         }
 
-        return map_iter->second->expired();
+        return !entries_.at(handle).expired();
     }
 
     // SetWithTTL sets a value in the cache with a TTL.
     void SetWithTTL(key_t key, value_t value, std::chrono::seconds ttl)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        sampled_timer timer(stats_.sample(false));
+        std::lock_guard<SharedMutex> lock(mutex_);
 
-        set_value(std::move(key), std::move(value), ttl);
+        auto now = std::chrono::system_clock::now();
+        int64_t cost = sizer_(value);
+        set_value(std::move(key), std::move(value), cost, ttl, now);
+        reap(now, reap_budget_);
     }
 
     // Set sets a value in the cache with a TTL.
@@ -144,37 +461,91 @@ public:
         SetWithTTL(std::move(key), std::move(value), ttl_);
     }
 
+    // SetWithCost sets a value charged `cost` against the capacity instead of
+    // what the sizer says, for callers that know the footprint better. An
+    // entry costing more than the whole capacity does not stay in the cache.
+    void SetWithCost(key_t key, value_t value, int64_t cost, std::chrono::seconds ttl)
+    {
+        sampled_timer timer(stats_.sample(false));
+        std::lock_guard<SharedMutex> lock(mutex_);
+
+        auto now = std::chrono::system_clock::now();
+        set_value(std::move(key), std::move(value), cost, ttl, now);
+        reap(now, reap_budget_);
+    }
+
+    void SetWithCost(key_t key, value_t value, int64_t cost)
+    {
+        SetWithCost(std::move(key), std::move(value), cost, ttl_);
+    }
+
+    // MultiSetWithTTL sets items[0..count), or items[index[0..count)] when
+    // index is given, under one lock and one clock read.
+    void MultiSetWithTTL(const std::pair<key_t, value_t>* items, const uint32_t* index, size_t count,
+        std::chrono::seconds ttl)
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+
+        auto now = std::chrono::system_clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto& item = items[index != nullptr ? index[i] : i];
+            key_t key = item.first;
+            value_t value = item.second;
+            int64_t cost = sizer_(value);
+            set_value(std::move(key), std::move(value), cost, ttl, now);
+        }
+        reap(now, reap_budget_ * count);
+    }
+
+    // MultiSet sets key/value pairs with the default TTL.
+    void MultiSet(const std::pair<key_t, value_t>* items, size_t count)
+    {
+        MultiSetWithTTL(items, nullptr, count, ttl_);
+    }
+
+    void MultiSet(const std::vector<std::pair<key_t, value_t>>& items)
+    {
+        MultiSetWithTTL(items.data(), nullptr, items.size(), ttl_);
+    }
+
     // SetIfAbsent will set the value in the cache if not present.
     // If the value exists in the cache, we don't set it.
     void SetIfAbsent(key_t key, value_t value)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::lock_guard<SharedMutex> lock(mutex_);
 
-        auto map_iter = list_iter_map_.find(key);
-        if (map_iter != list_iter_map_.end())
+        auto now = std::chrono::system_clock::now();
+        auto handle = entries_.find(key);
+        if (handle != entries_.end())
         {
-            auto now = std::chrono::system_clock::now();
-            if (!map_iter->second->expired(now))
+            if (!entries_.at(handle).expired(now))
             {
-                map_iter->second->ttl_ = ttl_;
-                map_iter->second->access_time_ = now;
-                move_to_front(map_iter->second);
+                entries_.at(handle).ttl_ = ttl_;
+                entries_.at(handle).access_time_ = now;
+                schedule(entries_.at(handle));
+                policy_.on_hit(entries_, handle);
+                return;
             }
         }
 
-        set_value(std::move(key), std::move(value), ttl_);
+        int64_t cost = sizer_(value);
+        set_value(std::move(key), std::move(value), cost, ttl_, now);
+        reap(now, reap_budget_);
     }
 
     // SetExpired will set an entry expired from the cache and returns if the
     // entry existed.
-    bool SetExpired(key_t key)
+    template<typename K>
+    bool SetExpired(const K& key)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::lock_guard<SharedMutex> lock(mutex_);
 
-        auto map_iter = list_iter_map_.find(key);
-        if (map_iter != list_iter_map_.end())
+        auto handle = entries_.find(key);
+        if (handle != entries_.end())
         {
-            map_iter->second->ttl_ = std::chrono::seconds(0);
+            entries_.at(handle).ttl_ = std::chrono::seconds(0);
+            schedule(entries_.at(handle));
             return true;
         }
 
@@ -182,43 +553,73 @@ public:
     }
 
     // Delete removes an entry from the cache, and returns if the entry existed.
-    bool Delete(key_t key)
+    template<typename K>
+    bool Delete(const K& key)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::lock_guard<SharedMutex> lock(mutex_);
 
-        auto iter = list_iter_map_.find(key);
-        if (iter != list_iter_map_.end())
+        auto handle = entries_.find(key);
+        if (handle != entries_.end())
         {
-            entry_list_.erase(iter);
-            size_--;
-            list_iter_map_.erase(key);
+            erase(handle);
             return true;
         }
         return false;
     }
 
+    // MultiDelete removes keys[0..count), or keys[index[0..count)] when index
+    // is given, under one lock and returns how many entries existed.
+    size_t MultiDelete(const key_t* keys, const uint32_t* index, size_t count)
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+
+        size_t deleted = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto handle = entries_.find(keys[index != nullptr ? index[i] : i]);
+            if (handle != entries_.end())
+            {
+                erase(handle);
+                deleted++;
+            }
+        }
+        return deleted;
+    }
+
+    size_t MultiDelete(const std::vector<key_t>& keys)
+    {
+        return MultiDelete(keys.data(), nullptr, keys.size());
+    }
+
     // Clear will clear the entire cache.
     void Clear()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::lock_guard<SharedMutex> lock(mutex_);
 
-        size_ = 0;
-        entry_list_.clear();
-        list_iter_map_.clear();
+        // pinned entries must survive the storage's clear
+        for (uint32_t segment = 0; segment < storage_type::segments; ++segment)
+        {
+            for (auto handle = entries_.front(segment); handle != entries_.end(); handle = entries_.front(segment))
+            {
+                erase(handle);
+            }
+        }
+        entries_.clear();
+        wheel_.Clear();
     }
 
     // Length returns how many elements are in the cache
     int64_t Length()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        SharedLock lock(mutex_);
 
-        return entry_list_.size();
+        return entries_.size();
     }
 
-    // Size returns the sum of the objects' Size() method.
+    // Size returns the sum of the entries' costs.
     int64_t Size()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        SharedLock lock(mutex_);
 
         return size_;
     }
@@ -226,93 +627,483 @@ public:
     // Capacity returns the cache maximum capacity.
     int64_t Capacity()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        SharedLock lock(mutex_);
 
         return capacity_;
     }
 
-    // FreeSize returns the cache's free capacity.
+    // FreeSize returns how much more cost the cache takes before evicting.
     int64_t FreeSize()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        SharedLock lock(mutex_);
 
         return capacity_ - size_;
     }
 
+    // ReapExpired removes expired entries, looking at no more than `budget`
+    // expiry records, and returns how many it looked at: less than budget
+    // means nothing is left to reap for now. Writes reap a few records each;
+    // caches that see few writes can be drained from an ExpirySweeper.
+    size_t ReapExpired(size_t budget)
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+
+        return reap(std::chrono::system_clock::now(), budget);
+    }
+
+    // SetReapBudget sets how many expiry records each write may reap.
+    void SetReapBudget(size_t budget)
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+        reap_budget_ = budget;
+    }
+
+    // SaveSnapshot writes the live entries to `path` for LoadSnapshot to warm
+    // a restarted cache with. The entries are pinned under the shared lock
+    // and written out without it, so the cache keeps serving while the file
+    // is written; entries set after the walk are not in the snapshot. It
+    // returns false, keeping any previous snapshot at `path`, if the file
+    // could not be written and synced in full.
+    bool SaveSnapshot(const std::string& path)
+    {
+        struct item
+        {
+            handle_t handle_;
+            int64_t ttl_;
+            int64_t remaining_;
+        };
+        std::vector<item> items;
+
+        auto now = std::chrono::system_clock::now();
+        {
+            SharedLock lock(mutex_);
+
+            items.reserve(entries_.size());
+            for (uint32_t segment = 0; segment < storage_type::segments; ++segment)
+            {
+                for (auto handle = entries_.front(segment); handle != entries_.end(); handle = entries_.next(handle))
+                {
+                    entry_t& e = entries_.at(handle);
+                    if (e.expired(now))
+                        continue;
+
+                    e.pins_.fetch_add(1);
+                    auto remaining = e.access_time_.load() + e.ttl_ - now;
+                    items.push_back({handle, e.ttl_.count() >= 0 ? static_cast<int64_t>(e.ttl_.count()) : -1,
+                        std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()});
+                }
+            }
+        }
+
+        // oldest first, the loader replays the file in order
+        snapshot_writer<key_t, value_t> writer(path,
+            std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count());
+        for (auto iter = items.rbegin(); writer.ok() && iter != items.rend(); ++iter)
+        {
+            const entry_t& e = entries_.at(iter->handle_);
+            writer.add(e.key_, e.value_, iter->ttl_, iter->remaining_);
+        }
+        bool ok = writer.commit();
+
+        std::vector<handle_t> handles;
+        handles.reserve(items.size());
+        for (const item& i : items)
+        {
+            handles.push_back(i.handle_);
+        }
+        unpin(handles.data(), handles.size());
+        return ok;
+    }
+
+    // LoadSnapshot sets the entries of a snapshot written by SaveSnapshot,
+    // keeping their recency order and what was left of their TTLs; entries
+    // that expired since the save are dropped. Values are charged by the
+    // sizer. It returns how many entries were set, or -1 if the file is
+    // missing, damaged or was saved by a cache of other types.
+    int64_t LoadSnapshot(const std::string& path)
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+
+        auto now = std::chrono::system_clock::now();
+        int64_t loaded = 0;
+        auto visit = [this, now, &loaded](const key_t& key, const value_t& value, int64_t ttl, int64_t remaining) {
+            auto access = now;
+            if (ttl >= 0)
+            {
+                access -= std::chrono::milliseconds(ttl * 1000 - remaining);
+                if (std::chrono::duration_cast<std::chrono::seconds>(now - access).count() > ttl)
+                    return;
+            }
+
+            key_t k = key;
+            value_t v = value;
+            int64_t cost = sizer_(v);
+            set_value(std::move(k), std::move(v), cost, std::chrono::seconds(ttl), access);
+            loaded++;
+        };
+
+        int64_t count = read_snapshot<key_t, value_t>(path,
+            std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count(), visit);
+        return count < 0 ? -1 : loaded;
+    }
+
     // SetCapacity will set the capacity of the cache. If the capacity is
-    // smaller, and the current cache size exceed that capacity, the cache
-    // will be shrank.
+    // smaller, and the current cache size exceed that capacity, entries are
+    // evicted until their costs fit.
     void SetCapacity(int64_t capacity)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::lock_guard<SharedMutex> lock(mutex_);
         capacity_ = capacity;
         check_capacity();
     }
 
+    // Stats returns a snapshot of the counters, and of the latency
+    // histograms if sampling was turned on. It takes no lock.
+    cache_stats Stats() const
+    {
+        return stats_.snapshot();
+    }
+
+    // SetLatencySampling times one Get and one Set in every `every`, 0
+    // turns sampling off.
+    void SetLatencySampling(uint32_t every)
+    {
+        stats_.set_sampling(every);
+    }
+
+    void ResetStats()
+    {
+        stats_.reset();
+    }
+
 private:
-    void check_capacity()
+    // hit records an access to a found entry and returns it, or nullptr if it
+    // has expired. The caller holds the lock, shared if the policy allows
+    // shared hits.
+    entry_t* hit(handle_t handle, std::chrono::system_clock::time_point now)
     {
-        while (size_ > capacity_)
+        entry_t& e = entries_.at(handle);
+        if (e.expired(now))
         {
-            std::cout << "size = " << size_ << std::endl;
-            auto iter = entry_list_.end();
-            iter--;
-            list_iter_map_.erase(iter->key_);
-            entry_list_.erase(iter);
-            size_--;
+            stats_.add(cache_counters::expired);
+            stats_.add(cache_counters::misses);
+            return nullptr;
         }
+
+        stats_.add(cache_counters::hits);
+        e.touch(now, policy_type::shared_hits ? std::chrono::milliseconds(1) : std::chrono::milliseconds(0));
+        policy_.on_hit(entries_, handle);
+        return &e;
     }
 
-    // add a new value
-    void set_value(key_t&& key, value_t&& value, std::chrono::seconds ttl)
+    // get_for_load is Get for GetOrLoad, it also tells whether the value is
+    // due for a refresh.
+    bool get_for_load(const key_t& key, value_t& value, bool& stale)
     {
+        HitLock lock(mutex_, policy_type::shared_hits);
+
+        auto handle = entries_.find(key);
+        if (handle == entries_.end())
+        {
+            stats_.add(cache_counters::misses);
+            return false;
+        }
+
         auto now = std::chrono::system_clock::now();
+        entry_t* e = hit(handle, now);
+        if (e == nullptr)
+        {
+            return false;
+        }
 
-        // replace old item if exist
-        auto map_iter = list_iter_map_.find(key);
+        value = e->value_;
+        stale = refresh_ahead_.count() > 0 && e->ttl_.count() >= 0 && now - e->write_time_ >= e->ttl_ - refresh_ahead_;
+        return true;
+    }
+
+    // load runs the single flight for key. A caller finding a load in flight
+    // waits for it. Otherwise it checks the cache once more under
+    // loads_mutex_: the loader publishes to the cache before it retires its
+    // flight, so the value is in one place or the other.
+    template<typename F>
+    void load(const key_t& key, F& loader, value_t& value)
+    {
+        std::promise<value_t> promise;
+        std::shared_future<value_t> flight;
+        {
+            std::lock_guard<std::mutex> lock(loads_mutex_);
+
+            auto iter = loads_.find(key);
+            if (iter != loads_.end())
+            {
+                flight = iter->second;
+            }
+            else if (Peek(key, value))
+            {
+                return;
+            }
+            else
+            {
+                loads_.insert(std::make_pair(key, promise.get_future().share()));
+            }
+        }
+
+        if (flight.valid())
+        {
+            value = flight.get();
+            return;
+        }
+
+        value = run_load(key, loader, promise);
+    }
+
+    // refresh starts a background reload of key as its flight, unless a
+    // load is already in flight. Finished reloads are reaped here.
+    template<typename F>
+    void refresh(const key_t& key, const F& loader)
+    {
+        std::lock_guard<std::mutex> lock(loads_mutex_);
+        refreshes_.remove_if([](const std::future<void>& f) {
+            return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        });
+        if (loads_.count(key) > 0)
+            return;
+
+        auto promise = std::make_shared<std::promise<value_t>>();
+        loads_.insert(std::make_pair(key, promise->get_future().share()));
+        refreshes_.push_back(std::async(std::launch::async, [this, key, loader, promise]() mutable {
+            try
+            {
+                run_load(key, loader, *promise);
+            }
+            catch (...)
+            {
+                stats_.add(cache_counters::refresh_failures);
+            }
+        }));
+    }
+
+    // run_load runs the loader of a flight this thread owns, publishes the
+    // value to the cache, then retires the flight with the value or the
+    // loader's exception, which it rethrows.
+    template<typename F>
+    value_t run_load(const key_t& key, F& loader, std::promise<value_t>& promise)
+    {
+        value_t value;
+        try
+        {
+            value = loader(key);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(loads_mutex_);
+            loads_.erase(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+
+        Set(key, value);
+        std::lock_guard<std::mutex> lock(loads_mutex_);
+        loads_.erase(key);
+        promise.set_value(value);
+        return value;
+    }
+
+    // multi_get resolves the keys in groups through the storage's batched
+    // find and calls emit(position, entry or nullptr) for each of them.
+    template<typename F>
+    size_t multi_get(const key_t* keys, const uint32_t* index, size_t count, F emit)
+    {
+        const size_t group = 16;
+        const key_t* group_keys[group];
+        handle_t handles[group];
+        size_t hits = 0;
+        size_t absent = 0;
 
-        // if existed, just replace its value.
-        if (map_iter != list_iter_map_.end())
+        HitLock lock(mutex_, policy_type::shared_hits);
+        auto now = std::chrono::system_clock::now();
+        for (size_t base = 0; base < count; base += group)
         {
-            map_iter->second->value_ = value;
-            map_iter->second->ttl_ = ttl;
-            map_iter->second->access_time_ = now;
-            move_to_front(map_iter->second);
+            const size_t n = std::min(group, count - base);
+            for (size_t j = 0; j < n; ++j)
+            {
+                group_keys[j] = &keys[index != nullptr ? index[base + j] : base + j];
+            }
+            entries_.find_batch(group_keys, n, handles);
+
+            for (size_t j = 0; j < n; ++j)
+            {
+                const size_t pos = index != nullptr ? index[base + j] : base + j;
+                entry_t* e = handles[j] == entries_.end() ? nullptr : hit(handles[j], now);
+                emit(pos, e);
+                hits += e != nullptr ? 1 : 0;
+                absent += handles[j] == entries_.end() ? 1 : 0;
+            }
+        }
+        if (absent > 0)
+            stats_.add(cache_counters::misses, absent);
+        return hits;
+    }
+
+    // schedule makes sure an expiry record fires no later than the entry's
+    // deadline. A pending record due earlier is kept, it reschedules itself.
+    void schedule(entry_t& e)
+    {
+        int64_t tick = e.deadline_tick();
+        if (tick < 0 || (e.wheel_id_ != 0 && e.wheel_tick_ <= tick))
             return;
+
+        e.wheel_id_ = wheel_.Schedule(e.key_, tick);
+        e.wheel_tick_ = tick;
+    }
+
+    size_t reap(std::chrono::system_clock::time_point now, size_t budget)
+    {
+        auto visit = [this, now](const key_t& key, uint32_t id) -> int64_t {
+            auto handle = entries_.find(key);
+            if (handle == entries_.end() || entries_.at(handle).wheel_id_ != id)
+                return -1; // deleted or replaced since
+
+            entry_t& e = entries_.at(handle);
+            if (e.expired(now))
+            {
+                erase(handle);
+                return -1;
+            }
+
+            // a sliding TTL moved the deadline, or the TTL was removed
+            e.wheel_tick_ = e.deadline_tick();
+            if (e.wheel_tick_ < 0)
+                e.wheel_id_ = 0;
+            return e.wheel_tick_;
+        };
+        return wheel_.Advance(ExpiryWheel<key_t>::Tick(now), budget, visit);
+    }
+
+    // erase removes an entry and gives its cost back. A pinned entry is only
+    // detached from the index and the lists, the last unpin frees it.
+    void erase(handle_t handle)
+    {
+        entry_t& e = entries_.at(handle);
+        policy_.on_erase(entries_, handle);
+        size_ -= e.cost_;
+        if (e.pins_.load() > 0)
+        {
+            e.detached_ = true;
+            entries_.detach(handle);
         }
+        else
+        {
+            entries_.erase(handle);
+        }
+    }
 
-        // if the list is empty
-        if (!entry_list_.empty())
+    // unpin drops a Pinned handle's reference and frees the entry if it was
+    // the last one on a detached entry. Detached entries cannot be found, so
+    // nothing pins them again between the two locks.
+    void unpin(handle_t handle)
+    {
+        unpin(&handle, 1);
+    }
+
+    // unpin drops one reference on each of the handles, taking the exclusive
+    // lock once for all the entries to free.
+    void unpin(handle_t* handles, size_t count)
+    {
+        size_t released = 0;
         {
-            // replace expired item of spare one.
-            auto list_iter = entry_list_.end();
-            list_iter--;
-            if (list_iter->expired(now))
+            SharedLock lock(mutex_);
+
+            for (size_t i = 0; i < count; ++i)
             {
-                list_iter_map_.erase(key);
-                list_iter->key_ = key;
-                list_iter->value_ = value;
-                list_iter->ttl_ = ttl;
-                list_iter->access_time_ = now;
-                list_iter_map_.insert(std::move(std::make_pair(key, list_iter)));
-                move_to_front(list_iter);
-                return;
+                entry_t& e = entries_.at(handles[i]);
+                if (e.pins_.fetch_add(-1) == 1 && e.detached_)
+                    handles[released++] = handles[i];
             }
         }
 
-        entry_list_.push_front(entry_t(key, std::move(value), ttl));
-        size_++;
-        list_iter_map_.insert(std::make_pair(key, entry_list_.begin()));
-        check_capacity();
+        if (released == 0)
+            return;
+
+        std::lock_guard<SharedMutex> lock(mutex_);
+        for (size_t i = 0; i < released; ++i)
+        {
+            entries_.release(handles[i]);
+        }
+    }
+
+    void check_capacity()
+    {
+        while (size_ > capacity_ && !entries_.empty())
+        {
+            erase(policy_.victim(entries_));
+            stats_.add(cache_counters::evictions);
+        }
     }
 
-    // move_to_front move the iter to front
-    void move_to_front(list_iterator_t& iter)
+    // add a new value
+    void set_value(key_t&& key, value_t&& value, int64_t cost, std::chrono::seconds ttl,
+        std::chrono::system_clock::time_point now)
     {
-        if (iter == entry_list_.begin() || iter == entry_list_.end())
+        // replace old item if exist
+        auto handle = entries_.find(key);
+
+        // if existed, just replace its value. Readers pinning the old value
+        // keep it, the new one goes to a new entry.
+        if (handle != entries_.end())
+            stats_.add(cache_counters::replacements);
+        else
+            stats_.add(cache_counters::inserts);
+
+        if (handle != entries_.end() && entries_.at(handle).pins_.load() > 0)
+        {
+            erase(handle);
+        }
+        else if (handle != entries_.end())
+        {
+            entries_.at(handle).value_ = std::move(value);
+            entries_.at(handle).ttl_ = ttl;
+            entries_.at(handle).access_time_ = now;
+            entries_.at(handle).write_time_ = now;
+            size_ += cost - entries_.at(handle).cost_;
+            entries_.at(handle).cost_ = cost;
+            schedule(entries_.at(handle));
+            policy_.on_hit(entries_, handle);
+            check_capacity();
             return;
+        }
 
-        entry_list_.splice(entry_list_.begin(), entry_list_, iter);
+        // replace expired item of spare one. Policies with several segments
+        // may have left the first one empty.
+        auto tail = entries_.back();
+        if (tail != entries_.end())
+        {
+            entry_t& spare = entries_.at(tail);
+            if (spare.expired(now) && spare.pins_.load() == 0)
+            {
+                policy_.on_erase(entries_, tail);
+                entries_.rekey(tail, key);
+                spare.value_ = std::move(value);
+                spare.ttl_ = ttl;
+                spare.access_time_ = now;
+                spare.write_time_ = now;
+                size_ += cost - spare.cost_;
+                spare.cost_ = cost;
+                spare.wheel_id_ = 0; // the old key's record is stale now
+                schedule(spare);
+                entries_.move_to_front(tail);
+                policy_.on_insert(entries_, tail);
+                check_capacity();
+                return;
+            }
+        }
+
+        handle = entries_.emplace_front(std::move(key), std::move(value), ttl, now);
+        entries_.at(handle).cost_ = cost;
+        schedule(entries_.at(handle));
+        policy_.on_insert(entries_, handle);
+        size_ += cost;
+        check_capacity();
     }
 };
 
@@ -327,12 +1118,579 @@ void lru_test()
     cache.SetWithTTL(1, 20, std::chrono::seconds(2));
     std::cout << "item 1 is exist : " << cache.IsExist(1) << std::endl;
     std::cout << cache.Get(1, res) << " - " << res << std::endl;
+
+    LruCache<int, int> expiry_cache(100);
+    for (int i = 0; i < 50; ++i)
+    {
+        expiry_cache.SetWithTTL(i, i, std::chrono::seconds(i < 40 ? 1 : -1));
+    }
+
     std::this_thread::sleep_for(std::chrono::milliseconds(3 * 1000));
     std::cout << cache.Get(1, res) << " - " << res << std::endl;
 
+    std::cout << "expiry : length = " << expiry_cache.Length();
+    expiry_cache.ReapExpired(64);
+    std::cout << ", after ReapExpired length = " << expiry_cache.Length() << std::endl;
+
     cache.SetIfAbsent(2, 200);
     std::cout << cache.Get(2, res) << " - " << res << std::endl;
     cache.SetExpired(2);
     std::this_thread::sleep_for(std::chrono::milliseconds(1 * 1000));
     std::cout << cache.Get(2, res) << " - " << res << std::endl;
+
+    LruCache<int, int, slab_storage> slab_cache(2, std::chrono::seconds(60));
+    slab_cache.Set(1, 10);
+    slab_cache.Set(2, 20);
+    slab_cache.Get(1, res);
+    slab_cache.Set(3, 30);
+    std::cout << "slab_storage : length = " << slab_cache.Length() << ", item 2 is exist : " << slab_cache.IsExist(2)
+              << ", item 1 is exist : " << slab_cache.IsExist(1) << std::endl;
+
+    // CLOCK keeps the referenced entry 1 and evicts 2, like LRU would.
+    LruCache<int, int, slab_storage, clock_policy> clock_cache(2, std::chrono::seconds(60));
+    clock_cache.Set(1, 10);
+    clock_cache.Set(2, 20);
+    clock_cache.Get(1, res);
+    clock_cache.Set(3, 30);
+    std::cout << "clock_policy : length = " << clock_cache.Length() << ", item 2 is exist : " << clock_cache.IsExist(2)
+              << ", item 1 is exist : " << clock_cache.IsExist(1) << std::endl;
+
+    std::vector<std::pair<int, int>> items = {{10, 100}, {11, 110}, {12, 120}};
+    std::vector<int> keys = {10, 11, 99, 12};
+    std::vector<int> values;
+    std::vector<bool> found;
+    cache.MultiSet(items);
+    std::cout << "MultiGet hits = " << cache.MultiGet(keys, values, found) << " :";
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        std::cout << " " << keys[i] << "=" << (found[i] ? values[i] : -1);
+    }
+    std::cout << std::endl;
+    std::cout << "MultiDelete = " << cache.MultiDelete(keys) << ", length = " << cache.Length() << std::endl;
+
+    // a 16 byte budget: the 10 byte blob pushes out the older strings
+    LruCache<int, std::string, list_storage, lru_policy, size_sizer> blobs(16);
+    blobs.Set(1, "aaaa");
+    blobs.Set(2, "bbbbbb");
+    blobs.Set(3, "cccccccccc");
+    std::cout << "size_sizer : length = " << blobs.Length() << ", size = " << blobs.Size()
+              << ", free = " << blobs.FreeSize() << ", item 1 is exist : " << blobs.IsExist(1) << std::endl;
+    blobs.SetWithCost(4, "d", 4);
+    blobs.SetCapacity(8);
+    std::cout << "SetCapacity(8) : length = " << blobs.Length() << ", size = " << blobs.Size()
+              << ", item 4 is exist : " << blobs.IsExist(4) << std::endl;
+
+    // a scan of cold keys does not push the hot keys out of a TinyLFU cache
+    LruCache<int, int, slab_storage, tinylfu_policy> admission_cache(100);
+    for (int round = 0; round < 3; ++round)
+    {
+        for (int i = 0; i < 100; ++i)
+            admission_cache.Set(i, i);
+    }
+    for (int i = 1000; i < 2000; ++i)
+    {
+        admission_cache.Set(i, i);
+    }
+    int hot = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        hot += admission_cache.Peek(i, res) ? 1 : 0;
+    }
+    std::cout << "tinylfu_policy : hot keys left after a scan = " << hot << std::endl;
+
+    // eight threads miss the same key at once, the loader runs once
+    LruCache<int, int> loading_cache(16, std::chrono::seconds(2));
+    std::atomic<int> loads{0};
+    auto loader = [&loads](const int& key) {
+        loads++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        return key * 10;
+    };
+    std::atomic<int> sum{0};
+    run_threads(8, [&](int) { sum += loading_cache.GetOrLoad(7, loader); });
+    std::cout << "GetOrLoad : sum = " << sum << ", loads = " << loads << std::endl;
+
+    // with a 1s refresh-ahead window a hit on a value over 1s old returns it
+    // at once and reloads it in the background; a failed reload is counted
+    loading_cache.SetRefreshAhead(std::chrono::seconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    auto hit_start = std::chrono::steady_clock::now();
+    loading_cache.GetOrLoad(7, loader);
+    const bool waited = std::chrono::steady_clock::now() - hit_start >= std::chrono::milliseconds(100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::cout << "GetOrLoad refresh-ahead : loads = " << loads << ", hit waited for the loader : " << waited;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    loading_cache.GetOrLoad(7, [](const int&) -> int { throw std::runtime_error("backend down"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::cout << ", refresh failures = " << loading_cache.Stats().refresh_failures_ << std::endl;
+
+    // a pinned value outlives its eviction; string keys are found by string_view
+    LruCache<std::string, std::string, slab_storage> pin_cache(1);
+    pin_cache.Set("first", "pinned value");
+    auto pinned = pin_cache.Pin(std::string_view("first"));
+    pin_cache.Set("second", "evicts the first");
+    std::cout << "Pin : first is exist : " << pin_cache.IsExist("first") << ", pinned = " << *pinned << std::endl;
+    pinned.reset();
+
+    // a key used twice outlives a scan under 2Q, ARC and LFU. 2Q only
+    // promotes a key that comes back after its eviction.
+    LruCache<int, int, slab_storage, two_queue_policy> two_queue(8);
+    LruCache<int, int, slab_storage, arc_policy> arc(8);
+    LruCache<int, int, slab_storage, lfu_policy> lfu(8);
+    for (int i = 0; i < 10; ++i)
+    {
+        two_queue.Set(i, i);
+    }
+    arc.Set(0, 0);
+    arc.Get(0, res);
+    lfu.Set(0, 0);
+    lfu.Get(0, res);
+    two_queue.Set(0, 0);
+    for (int i = 100; i < 120; ++i)
+    {
+        two_queue.Set(i, i);
+        arc.Set(i, i);
+        lfu.Set(i, i);
+    }
+    std::cout << "2Q/ARC/LFU : hot key is exist : " << two_queue.IsExist(0) << "/" << arc.IsExist(0) << "/"
+              << lfu.IsExist(0) << std::endl;
+
+    // a snapshot warms a new cache with the same entries in the same order
+    const std::string snapshot_path = "lru_test.snapshot";
+    LruCache<std::string, std::string> saved(4, std::chrono::seconds(60));
+    saved.Set("a", "1");
+    saved.Set("b", "2");
+    saved.SetWithTTL("c", "3", std::chrono::seconds(-1));
+    std::string value;
+    saved.Get("a", value);
+    LruCache<std::string, std::string> restored(4, std::chrono::seconds(60));
+    bool saved_ok = saved.SaveSnapshot(snapshot_path);
+    std::cout << "snapshot : saved = " << saved_ok << ", loaded = " << restored.LoadSnapshot(snapshot_path);
+    restored.Set("d", "4");
+    restored.Set("e", "5"); // evicts b, the least recently used before the restart
+    std::cout << ", b is exist : " << restored.IsExist("b") << ", a is exist : " << restored.IsExist("a") << std::endl;
+    std::remove(snapshot_path.c_str());
+
+    // counters and sampled latencies
+    LruCache<int, int> counted(2);
+    counted.SetLatencySampling(1);
+    counted.Set(1, 1);
+    counted.Set(2, 2);
+    counted.Set(2, 20);
+    counted.Set(3, 3);
+    counted.Get(3, res);
+    counted.Get(1, res);
+    cache_stats stats = counted.Stats();
+    std::cout << "Stats : hits = " << stats.hits_ << ", misses = " << stats.misses_
+              << ", evictions = " << stats.evictions_ << ", inserts = " << stats.inserts_
+              << ", replacements = " << stats.replacements_ << ", sampled gets = " << stats.get_latency_.count()
+              << std::endl;
+}
+
+// batch_bench compares a Get per key with one MultiGet per batch on a cache
+// much larger than the CPU caches, 90% of the keys being hits.
+template<template<typename, typename> class storage_t>
+void batch_bench(const char* name, int capacity, int batch, int batches)
+{
+    LruCache<int, int, storage_t> cache(capacity);
+    for (int i = 0; i < capacity; ++i)
+    {
+        cache.Set(static_cast<int>(mix_hash(i) & 0x3FFFFFFF), i);
+    }
+
+    // separate key sets, so neither path runs on lines the other one loaded
+    std::vector<int> keys(batch);
+    std::vector<int> batch_keys(batch);
+    std::vector<int> values(batch);
+    std::unique_ptr<bool[]> found(new bool[batch]);
+    std::chrono::nanoseconds single(0);
+    std::chrono::nanoseconds multi(0);
+    int64_t hits = 0;
+    for (int b = 0; b < batches; ++b)
+    {
+        for (int i = 0; i < batch; ++i)
+        {
+            int id = static_cast<int>(fast_rand() % (capacity + capacity / 9));
+            keys[i] = static_cast<int>(mix_hash(id) & 0x3FFFFFFF);
+            id = static_cast<int>(fast_rand() % (capacity + capacity / 9));
+            batch_keys[i] = static_cast<int>(mix_hash(id) & 0x3FFFFFFF);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < batch; ++i)
+        {
+            hits += cache.Get(keys[i], values[i]);
+        }
+        auto middle = std::chrono::steady_clock::now();
+        hits += cache.MultiGet(batch_keys.data(), batch_keys.size(), values.data(), found.get());
+        multi += std::chrono::steady_clock::now() - middle;
+        single += middle - start;
+    }
+
+    const int64_t lookups = int64_t(batch) * batches;
+    std::cout << name << "\tbatch = " << batch << "\tGet = " << single.count() / lookups
+              << " ns/key\tMultiGet = " << multi.count() / lookups << " ns/key\t(" << hits % 10 << ")" << std::endl;
+}
+
+// lru_expiry_bench lets most of a large cache expire, then drains it two
+// ways: through the reaping budget of ordinary writes, and in sweeper-sized
+// chunks. Both report call latency percentiles, the point being that no
+// single call pays for the whole expired set.
+void lru_expiry_bench()
+{
+    std::cout << "-------------------LRU expiry bench (latency in ns)---------------------" << std::endl;
+    const int expiring = 500000;
+    const int live = 10000;
+
+    LruCache<int, int, slab_storage> writes(2 * expiring);
+    LruCache<int, int, slab_storage> chunks(2 * expiring);
+    for (int i = 0; i < expiring + live; ++i)
+    {
+        auto ttl = std::chrono::seconds(i < expiring ? 1 : -1);
+        writes.SetWithTTL(i, i, ttl);
+        chunks.SetWithTTL(i, i, ttl);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * 1000));
+
+    std::vector<int64_t> latency;
+    int64_t ops = 0;
+    while (writes.Length() > live + ops)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        writes.Set(expiring + live + static_cast<int>(ops), 0);
+        latency.push_back((std::chrono::steady_clock::now() - begin).count());
+        ops++;
+    }
+    std::cout << "writes : " << ops << " Sets drained " << expiring << " expired entries, p50 = "
+              << percentile(latency, 50) << ", p99 = " << percentile(latency, 99)
+              << ", max = " << percentile(latency, 100) << std::endl;
+
+    latency.clear();
+    size_t reaped = 256;
+    while (reaped >= 256)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        reaped = chunks.ReapExpired(256);
+        latency.push_back((std::chrono::steady_clock::now() - begin).count());
+    }
+    std::cout << "chunks : " << latency.size() << " ReapExpired(256) calls, p50 = " << percentile(latency, 50)
+              << ", p99 = " << percentile(latency, 99) << ", max = " << percentile(latency, 100)
+              << ", length = " << chunks.Length() << std::endl;
+}
+
+// snapshot_pause_bench times Gets from a reader thread while the main thread
+// saves snapshots of the cache, the pause readers see during a save.
+template<template<typename> class policy_t>
+void snapshot_pause_bench(const char* name, int count, const std::string& path)
+{
+    LruCache<int, int, slab_storage, policy_t> cache(count);
+    for (int i = 0; i < count; ++i)
+    {
+        cache.Set(i, i);
+    }
+
+    std::atomic<bool> done{false};
+    std::vector<int64_t> latency;
+    std::thread reader([&cache, &done, &latency, count]() {
+        int value = 0;
+        while (!done.load())
+        {
+            auto begin = std::chrono::steady_clock::now();
+            cache.Get(static_cast<int>(fast_rand() % count), value);
+            latency.push_back((std::chrono::steady_clock::now() - begin).count());
+        }
+    });
+
+    for (int i = 0; i < 3; ++i)
+    {
+        cache.SaveSnapshot(path);
+    }
+    done = true;
+    reader.join();
+    std::cout << name << " : Get during SaveSnapshot, p50 = " << percentile(latency, 50)
+              << ", p99 = " << percentile(latency, 99) << ", max = " << percentile(latency, 100) << std::endl;
+}
+
+void lru_snapshot_bench()
+{
+    std::cout << "-------------------LRU snapshot bench---------------------" << std::endl;
+    const std::string path = "lru_bench.snapshot";
+    auto ms = [](std::chrono::nanoseconds elapsed) { return elapsed.count() / 1000000; };
+
+    const int count = 1000000;
+    LruCache<int, int, slab_storage> ints(count);
+    for (int i = 0; i < count; ++i)
+    {
+        ints.Set(i, i);
+    }
+    auto begin = std::chrono::steady_clock::now();
+    ints.SaveSnapshot(path);
+    auto save = std::chrono::steady_clock::now() - begin;
+
+    LruCache<int, int, slab_storage> int_restored(count);
+    begin = std::chrono::steady_clock::now();
+    int64_t loaded = int_restored.LoadSnapshot(path);
+    auto load = std::chrono::steady_clock::now() - begin;
+
+    struct stat st;
+    int64_t bytes = ::stat(path.c_str(), &st) == 0 ? static_cast<int64_t>(st.st_size) : -1;
+    std::cout << "int/int : " << loaded << " entries, save = " << ms(save) << " ms, load = " << ms(load)
+              << " ms, file = " << bytes / 1024 << " KB" << std::endl;
+
+    const int string_count = 200000;
+    LruCache<std::string, std::string, slab_storage> strings(string_count);
+    for (int i = 0; i < string_count; ++i)
+    {
+        strings.Set("key-" + std::to_string(i), std::string(64, static_cast<char>('a' + i % 26)));
+    }
+    begin = std::chrono::steady_clock::now();
+    strings.SaveSnapshot(path);
+    save = std::chrono::steady_clock::now() - begin;
+
+    LruCache<std::string, std::string, slab_storage> string_restored(string_count);
+    begin = std::chrono::steady_clock::now();
+    loaded = string_restored.LoadSnapshot(path);
+    load = std::chrono::steady_clock::now() - begin;
+    bytes = ::stat(path.c_str(), &st) == 0 ? static_cast<int64_t>(st.st_size) : -1;
+    std::cout << "string/string : " << loaded << " entries, save = " << ms(save) << " ms, load = " << ms(load)
+              << " ms, file = " << bytes / 1024 << " KB" << std::endl;
+
+    snapshot_pause_bench<lru_policy>("lru_policy", count, path);
+    snapshot_pause_bench<clock_policy>("clock_policy", count, path);
+    std::remove(path.c_str());
+}
+
+void lru_batch_bench()
+{
+    std::cout << "-------------------LRU MultiGet bench---------------------" << std::endl;
+    const int capacity = 1 << 20;
+    int batches[] = {20, 200};
+    for (int batch : batches)
+    {
+        batch_bench<list_storage>("list_storage", capacity, batch, 200000 / batch);
+        batch_bench<slab_storage>("slab_storage", capacity, batch, 200000 / batch);
+    }
+}
+
+// counted_blob is a multi-KB value that counts its copies and moves, like
+// MyClass in main.cpp but quiet: the benchmark prints the totals. Every copy
+// allocates a new payload, a move does not.
+class counted_blob
+{
+public:
+    static int64_t copies_;
+    static int64_t moves_;
+
+    std::vector<char> bytes_;
+
+    counted_blob() = default;
+
+    explicit counted_blob(std::size_t size)
+        : bytes_(size, 'x')
+    {
+    }
+
+    counted_blob(const counted_blob& other)
+        : bytes_(other.bytes_)
+    {
+        copies_++;
+    }
+
+    counted_blob(counted_blob&& other) noexcept
+        : bytes_(std::move(other.bytes_))
+    {
+        moves_++;
+    }
+
+    counted_blob& operator=(const counted_blob& other)
+    {
+        bytes_ = other.bytes_;
+        copies_++;
+        return *this;
+    }
+
+    counted_blob& operator=(counted_blob&& other) noexcept
+    {
+        bytes_ = std::move(other.bytes_);
+        moves_++;
+        return *this;
+    }
+
+    static void reset()
+    {
+        copies_ = moves_ = 0;
+    }
+};
+
+int64_t counted_blob::copies_ = 0;
+int64_t counted_blob::moves_ = 0;
+
+// lru_copy_bench counts the value copies and moves of inserts and reads of
+// 4 KB values, compares Get (copy out) with Pin (read in place), and string
+// keys looked up as std::string built per call with string_view lookups.
+void lru_copy_bench()
+{
+    std::cout << "-------------------LruCache copies and moves (4 KB values)---------------------" << std::endl;
+    const int keys = 1000;
+    const int ops = 200000;
+    LruCache<std::string, counted_blob, slab_storage, clock_policy> cache(keys);
+    std::vector<std::string> names;
+    for (int i = 0; i < keys; ++i)
+    {
+        names.push_back("user:session:" + std::to_string(i) + ":profile"); // too long for SSO
+    }
+
+    auto report = [](const char* name, int64_t count, std::chrono::nanoseconds elapsed) {
+        std::cout << name << "\tcopies/op = " << double(counted_blob::copies_) / count
+                  << "\tmoves/op = " << double(counted_blob::moves_) / count
+                  << "\tns/op = " << elapsed.count() / count << std::endl;
+        counted_blob::reset();
+    };
+
+    counted_blob::reset();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < keys; ++i)
+    {
+        cache.Set(names[i], counted_blob(4096));
+    }
+    report("Set(rvalue)", keys, std::chrono::steady_clock::now() - start);
+
+    counted_blob lvalue(4096);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < keys; ++i)
+    {
+        cache.Set(names[i], lvalue);
+    }
+    report("Set(lvalue)", keys, std::chrono::steady_clock::now() - start);
+
+    counted_blob out;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i)
+    {
+        cache.Get(names[fast_rand() % keys], out);
+    }
+    report("Get", ops, std::chrono::steady_clock::now() - start);
+
+    int64_t bytes = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i)
+    {
+        auto pinned = cache.Pin(names[fast_rand() % keys]);
+        bytes += pinned ? pinned->bytes_.size() : 0;
+    }
+    report("Pin", ops, std::chrono::steady_clock::now() - start);
+
+    std::cout << "-------------------string key lookups (ns/op)---------------------" << std::endl;
+    std::vector<const char*> raw;
+    for (auto& name : names)
+    {
+        raw.push_back(name.c_str());
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i)
+    {
+        bytes += cache.Pin(std::string(raw[fast_rand() % keys])) ? 1 : 0;
+    }
+    auto elapsed_string = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i)
+    {
+        bytes += cache.Pin(std::string_view(raw[fast_rand() % keys])) ? 1 : 0;
+    }
+    auto elapsed_view = std::chrono::steady_clock::now() - start;
+    std::cout << "std::string = " << elapsed_string.count() / ops << "\tstring_view = " << elapsed_view.count() / ops
+              << "\t(" << bytes % 10 << ")" << std::endl;
+}
+
+// lru_tinylfu_bench compares the hit ratio of plain LRU and LRU behind the
+// TinyLFU admission filter on the standard traces, at a few cache sizes.
+void lru_tinylfu_bench(const std::string& trace_path)
+{
+    std::cout << "-------------------LRU vs TinyLFU hit ratio---------------------" << std::endl;
+    int capacities[] = {500, 2000, 10000};
+    for (const auto& trace : bench_traces(trace_path))
+    {
+        for (int capacity : capacities)
+        {
+            LruCache<int, int, slab_storage, lru_policy> lru(capacity);
+            LruCache<int, int, slab_storage, tinylfu_policy> tinylfu(capacity);
+            std::cout << trace.name_ << "\tcapacity = " << capacity << "\tLRU = " << replay(lru, trace.keys_)
+                      << "\tTinyLFU = " << replay(tinylfu, trace.keys_) << std::endl;
+        }
+    }
+}
+
+// lru_policy_bench compares the hit ratio of every eviction policy on the
+// standard traces, and the cost of a replayed access.
+void lru_policy_bench(const std::string& trace_path)
+{
+    std::cout << "-------------------eviction policies hit ratio (ns/access)---------------------" << std::endl;
+    int capacities[] = {500, 10000};
+    auto run = [](const char* name, auto&& cache, const trace_t& keys) {
+        auto start = std::chrono::steady_clock::now();
+        double ratio = replay(cache, keys);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "\t" << name << " = " << ratio << " (" << elapsed.count() / int64_t(keys.size()) << ")";
+    };
+
+    for (const auto& trace : bench_traces(trace_path))
+    {
+        for (int capacity : capacities)
+        {
+            std::cout << trace.name_ << "\tcapacity = " << capacity << std::endl;
+            run("LRU", LruCache<int, int, slab_storage, lru_policy>(capacity), trace.keys_);
+            run("CLOCK", LruCache<int, int, slab_storage, clock_policy>(capacity), trace.keys_);
+            run("TinyLFU", LruCache<int, int, slab_storage, tinylfu_policy>(capacity), trace.keys_);
+            std::cout << std::endl;
+            run("2Q", LruCache<int, int, slab_storage, two_queue_policy>(capacity), trace.keys_);
+            run("ARC", LruCache<int, int, slab_storage, arc_policy>(capacity), trace.keys_);
+            run("LFU", LruCache<int, int, slab_storage, lfu_policy>(capacity), trace.keys_);
+            std::cout << std::endl;
+        }
+    }
+}
+
+// lru_clock_bench compares exact LRU with CLOCK: hit ratio on traces, and
+// Get throughput when every thread reads the same few hot keys.
+void lru_clock_bench(const std::string& trace_path)
+{
+    std::cout << "-------------------LRU vs CLOCK hit ratio---------------------" << std::endl;
+    const int capacity = 1000;
+    for (const auto& trace : bench_traces(trace_path))
+    {
+        LruCache<int, int, slab_storage, lru_policy> lru(capacity);
+        LruCache<int, int, slab_storage, clock_policy> clock(capacity);
+        std::cout << trace.name_ << "\tLRU = " << replay(lru, trace.keys_) << "\tCLOCK = " << replay(clock, trace.keys_)
+                  << std::endl;
+    }
+
+    std::cout << "-------------------LRU vs CLOCK hot-key Get (Mops/s)---------------------" << std::endl;
+    const int ops = 200000;
+    const int hot_keys = 64;
+    int counts[] = {1, 4, 16, 32};
+    for (int threads : counts)
+    {
+        LruCache<int, int, slab_storage, lru_policy> lru(capacity);
+        LruCache<int, int, slab_storage, clock_policy> clock(capacity);
+        for (int i = 0; i < hot_keys; ++i)
+        {
+            lru.Set(i, i);
+            clock.Set(i, i);
+        }
+
+        auto elapsed_lru = run_threads(threads, [&lru, ops, hot_keys](int) {
+            int value = 0;
+            for (int i = 0; i < ops; ++i)
+                lru.Get(static_cast<int>(fast_rand() % hot_keys), value);
+        });
+        auto elapsed_clock = run_threads(threads, [&clock, ops, hot_keys](int) {
+            int value = 0;
+            for (int i = 0; i < ops; ++i)
+                clock.Get(static_cast<int>(fast_rand() % hot_keys), value);
+        });
+        std::cout << "threads = " << threads << "\tLRU = " << mops(int64_t(threads) * ops, elapsed_lru)
+                  << "\tCLOCK = " << mops(int64_t(threads) * ops, elapsed_clock) << std::endl;
+    }
 }
@@ -0,0 +1,493 @@
+#pragma once
+
+#include "head.hpp"
+#include "frequency_sketch.hpp"
+#include "lru_storage.hpp"
+
+#include <list>
+
+// Eviction policies for LruCache. A policy is instantiated with the cache's
+// storage engine and decides what a hit does and which entry is evicted:
+//
+//   shared_hits                  on_hit is safe under the shared lock
+//   on_insert(entries, handle)   a new entry was put at the front
+//   on_hit(entries, handle)      an entry was read or updated
+//   on_erase(entries, handle)    an entry is about to leave the cache
+//   victim(entries)              entry to evict, entries.end() if empty
+//
+// The cache inserts before it evicts, so victim() sees the new entry too.
+// Policies with several queues keep them in the storage's segments; keys
+// remembered after their eviction go to a ghost_list.
+
+// ghost_list is a key-only LRU list: the keys of recently evicted entries,
+// most recent first, for policies that adapt to misses on them.
+template<typename key_t>
+class ghost_list
+{
+private:
+    std::list<key_t> keys_;
+    std::unordered_map<key_t, typename std::list<key_t>::iterator, key_hash<key_t>> index_;
+
+public:
+    std::size_t size() const
+    {
+        return keys_.size();
+    }
+
+    bool contains(const key_t& key) const
+    {
+        return index_.find(key) != index_.end();
+    }
+
+    void push_front(const key_t& key)
+    {
+        auto iter = index_.find(key);
+        if (iter != index_.end())
+        {
+            keys_.splice(keys_.begin(), keys_, iter->second);
+            return;
+        }
+
+        keys_.push_front(key);
+        index_.insert(std::make_pair(key, keys_.begin()));
+    }
+
+    // erase forgets a key, returns whether it was there.
+    bool erase(const key_t& key)
+    {
+        auto iter = index_.find(key);
+        if (iter == index_.end())
+            return false;
+
+        keys_.erase(iter->second);
+        index_.erase(iter);
+        return true;
+    }
+
+    void pop_back()
+    {
+        index_.erase(keys_.back());
+        keys_.pop_back();
+    }
+};
+
+/// <summary>
+/// lru_policy is exact LRU: every hit moves the entry to the front, so hits
+/// need the exclusive lock.
+/// </summary>
+template<typename storage_type>
+class lru_policy
+{
+public:
+    using handle_t = typename storage_type::handle_t;
+
+    static const bool shared_hits = false;
+
+    void on_insert(storage_type&, handle_t)
+    {
+    }
+
+    void on_hit(storage_type& entries, handle_t handle)
+    {
+        entries.move_to_front(handle);
+    }
+
+    void on_erase(storage_type&, handle_t)
+    {
+    }
+
+    handle_t victim(storage_type& entries)
+    {
+        return entries.back();
+    }
+};
+
+/// <summary>
+/// clock_policy is CLOCK (second chance), an approximation of LRU. A hit only
+/// sets the entry's reference bit, so concurrent hits run under the shared
+/// lock; the list is reordered only while looking for a victim.
+/// </summary>
+template<typename storage_type>
+class clock_policy
+{
+public:
+    using handle_t = typename storage_type::handle_t;
+
+    static const bool shared_hits = true;
+
+    void on_insert(storage_type& entries, handle_t handle)
+    {
+        entries.at(handle).referenced_ = false;
+    }
+
+    void on_hit(storage_type& entries, handle_t handle)
+    {
+        // test before set, a hot entry's cache line stays shared between readers
+        auto& e = entries.at(handle);
+        if (!e.referenced_.load())
+        {
+            e.referenced_ = true;
+        }
+    }
+
+    void on_erase(storage_type&, handle_t)
+    {
+    }
+
+    // victim sweeps from the tail: a referenced entry loses its bit and goes
+    // round again, the first unreferenced one is the victim.
+    handle_t victim(storage_type& entries)
+    {
+        auto handle = entries.back();
+        while (handle != entries.end() && entries.at(handle).referenced_.load())
+        {
+            entries.at(handle).referenced_ = false;
+            entries.move_to_front(handle);
+            handle = entries.back();
+        }
+        return handle;
+    }
+};
+
+/// <summary>
+/// tinylfu_policy is W-TinyLFU: new entries enter a small LRU window (about
+/// 1% of the entries, storage segment 0) in front of the LRU main area
+/// (segment 1). When the cache is full the window's oldest entry competes
+/// with the main area's victim and is admitted only if the frequency sketch
+/// rates it more popular, otherwise it is evicted itself. A scan of one-off
+/// keys passes through the window without flushing the hot set, and the
+/// window still gives a burst of new keys time to prove themselves.
+/// </summary>
+template<typename storage_type>
+class tinylfu_policy
+{
+public:
+    using handle_t = typename storage_type::handle_t;
+
+    static const bool shared_hits = false; // hits update the sketch
+
+private:
+    static const uint32_t window = 0;
+    static const uint32_t main = 1;
+
+    frequency_sketch sketch_;
+    std::hash<typename storage_type::key_type> hasher_;
+
+public:
+    void on_insert(storage_type& entries, handle_t handle)
+    {
+        // the sketch grows with the cache, a few times while it fills up
+        if (entries.size() > sketch_.capacity())
+            sketch_.reserve(entries.size() * 2);
+        record(entries, handle);
+
+        // while the cache fills up the window overflows into the main area
+        // unopposed; once full, victim() takes over.
+        if (entries.size(window) > window_limit(entries) + 1)
+            entries.move_to_front(entries.back(window), main);
+    }
+
+    void on_hit(storage_type& entries, handle_t handle)
+    {
+        record(entries, handle);
+        entries.move_to_front(handle);
+    }
+
+    void on_erase(storage_type&, handle_t)
+    {
+    }
+
+    handle_t victim(storage_type& entries)
+    {
+        const std::size_t limit = window_limit(entries);
+        while (entries.size(window) > limit + 1)
+        {
+            entries.move_to_front(entries.back(window), main); // the cache has shrunk
+        }
+
+        handle_t victim = entries.back(main);
+        if (entries.size(window) <= limit || victim == entries.end())
+            return victim != entries.end() ? victim : entries.back(window);
+
+        // the window is over its share: admission duel
+        handle_t candidate = entries.back(window);
+        if (frequency(entries, candidate) <= frequency(entries, victim))
+            return candidate;
+
+        entries.move_to_front(candidate, main);
+        return victim;
+    }
+
+private:
+    static std::size_t window_limit(storage_type& entries)
+    {
+        return std::max<std::size_t>(1, entries.size() / 100);
+    }
+
+    uint64_t hash_of(storage_type& entries, handle_t handle) const
+    {
+        return hasher_(entries.at(handle).key_);
+    }
+
+    int frequency(storage_type& entries, handle_t handle) const
+    {
+        return sketch_.frequency(hash_of(entries, handle));
+    }
+
+    void record(storage_type& entries, handle_t handle)
+    {
+        sketch_.increment(hash_of(entries, handle));
+    }
+};
+
+template<typename storage_type>
+const uint32_t tinylfu_policy<storage_type>::window;
+
+template<typename storage_type>
+const uint32_t tinylfu_policy<storage_type>::main;
+
+/// <summary>
+/// two_queue_policy is 2Q (Johnson and Shasha): new entries go to a FIFO
+/// (storage segment 0, about a quarter of the entries) and hits there do
+/// nothing. An entry evicted from the FIFO leaves its key in a ghost list of
+/// about half the entries; a key that comes back while remembered there has
+/// proven itself and goes to the LRU main queue (segment 1). Scans only ever
+/// cycle through the FIFO.
+/// </summary>
+template<typename storage_type>
+class two_queue_policy
+{
+public:
+    using handle_t = typename storage_type::handle_t;
+
+    static const bool shared_hits = false;
+
+private:
+    static const uint32_t in = 0;
+    static const uint32_t main = 1;
+
+    ghost_list<typename storage_type::key_type> out_;
+
+public:
+    void on_insert(storage_type& entries, handle_t handle)
+    {
+        if (out_.erase(entries.at(handle).key_))
+            entries.move_to_front(handle, main);
+    }
+
+    void on_hit(storage_type& entries, handle_t handle)
+    {
+        if (entries.segment(handle) == main)
+            entries.move_to_front(handle);
+    }
+
+    void on_erase(storage_type&, handle_t)
+    {
+    }
+
+    handle_t victim(storage_type& entries)
+    {
+        const std::size_t in_limit = std::max<std::size_t>(1, entries.size() / 4);
+        if (entries.size(in) <= in_limit && entries.size(main) > 0)
+            return entries.back(main);
+
+        handle_t victim = entries.back(in);
+        if (victim != entries.end())
+        {
+            out_.push_front(entries.at(victim).key_);
+            while (out_.size() > std::max<std::size_t>(1, entries.size() / 2))
+            {
+                out_.pop_back();
+            }
+        }
+        return victim;
+    }
+};
+
+template<typename storage_type>
+const uint32_t two_queue_policy<storage_type>::in;
+
+template<typename storage_type>
+const uint32_t two_queue_policy<storage_type>::main;
+
+/// <summary>
+/// arc_policy is ARC (Megiddo and Modha): T1 (segment 0) holds entries seen
+/// once recently, T2 (segment 1) entries seen at least twice. Evicted keys
+/// are remembered in the ghost lists B1 and B2, and a miss on a ghost moves
+/// the target size p of T1: up for B1, recency is paying off, down for B2.
+/// The capacity c is taken as the current entry count.
+/// </summary>
+template<typename storage_type>
+class arc_policy
+{
+public:
+    using handle_t = typename storage_type::handle_t;
+
+    static const bool shared_hits = false;
+
+private:
+    static const uint32_t t1 = 0;
+    static const uint32_t t2 = 1;
+
+    ghost_list<typename storage_type::key_type> b1_;
+    ghost_list<typename storage_type::key_type> b2_;
+    std::size_t p_{0};       // target size of T1
+    bool from_b2_{false};   // the last insert was a B2 ghost
+
+public:
+    void on_insert(storage_type& entries, handle_t handle)
+    {
+        const auto& key = entries.at(handle).key_;
+        const std::size_t c = entries.size();
+        from_b2_ = false;
+
+        if (b1_.contains(key))
+        {
+            p_ = std::min(c, p_ + std::max<std::size_t>(1, b2_.size() / b1_.size()));
+            b1_.erase(key);
+            entries.move_to_front(handle, t2);
+        }
+        else if (b2_.contains(key))
+        {
+            const std::size_t delta = std::max<std::size_t>(1, b1_.size() / b2_.size());
+            p_ = p_ > delta ? p_ - delta : 0;
+            b2_.erase(key);
+            entries.move_to_front(handle, t2);
+            from_b2_ = true;
+        }
+    }
+
+    void on_hit(storage_type& entries, handle_t handle)
+    {
+        entries.move_to_front(handle, t2);
+    }
+
+    void on_erase(storage_type&, handle_t)
+    {
+    }
+
+    // victim is ARC's REPLACE. It runs after the insert, so the newest T1
+    // entry, the one being inserted, does not count towards T1.
+    handle_t victim(storage_type& entries)
+    {
+        std::size_t recent = entries.size(t1);
+        recent -= recent > 0 ? 1 : 0;
+        const bool from_t1 = (recent > 0 && (recent > p_ || (from_b2_ && recent == p_))) || entries.size(t2) == 0;
+        from_b2_ = false;
+
+        handle_t victim = entries.back(from_t1 ? t1 : t2);
+        if (victim == entries.end())
+            return victim;
+
+        (from_t1 ? b1_ : b2_).push_front(entries.at(victim).key_);
+
+        // |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c
+        const std::size_t c = entries.size();
+        while (b1_.size() > 0 && entries.size(t1) + b1_.size() > c)
+        {
+            b1_.pop_back();
+        }
+        while (b2_.size() > 0 && c + b1_.size() + b2_.size() > 2 * c)
+        {
+            b2_.pop_back();
+        }
+        return victim;
+    }
+};
+
+template<typename storage_type>
+const uint32_t arc_policy<storage_type>::t1;
+
+template<typename storage_type>
+const uint32_t arc_policy<storage_type>::t2;
+
+/// <summary>
+/// lfu_policy is O(1) LFU (Shah, Mitra and Matani): the entries are kept in
+/// buckets of equal access count, the buckets in a list by ascending count.
+/// A hit moves the entry to the next bucket, creating it if needed, and the
+/// victim is the least recently used entry of the first bucket; every step
+/// is constant time. Counts never age, so LFU suits stable popularity. The
+/// buckets index the storage's handles, one list and one map node per entry.
+/// </summary>
+template<typename storage_type>
+class lfu_policy
+{
+public:
+    using handle_t = typename storage_type::handle_t;
+
+    static const bool shared_hits = false;
+
+private:
+    struct bucket
+    {
+        uint64_t count_;
+        std::list<handle_t> handles_; // most recently used first
+    };
+
+    struct position
+    {
+        typename std::list<bucket>::iterator bucket_;
+        typename std::list<handle_t>::iterator self_;
+    };
+
+    std::list<bucket> buckets_; // by ascending count
+    std::unordered_map<handle_t, position> positions_;
+    handle_t newest_{};         // the last insert, spared while alone in its bucket
+    bool has_newest_{false};
+
+public:
+    void on_insert(storage_type&, handle_t handle)
+    {
+        if (buckets_.empty() || buckets_.front().count_ != 1)
+            buckets_.push_front(bucket{1, {}});
+
+        auto first = buckets_.begin();
+        first->handles_.push_front(handle);
+        positions_[handle] = position{first, first->handles_.begin()};
+        newest_ = handle;
+        has_newest_ = true;
+    }
+
+    void on_hit(storage_type&, handle_t handle)
+    {
+        position& pos = positions_.find(handle)->second;
+        auto current = pos.bucket_;
+        auto next = std::next(current);
+        if (next == buckets_.end() || next->count_ != current->count_ + 1)
+            next = buckets_.insert(next, bucket{current->count_ + 1, {}});
+
+        next->handles_.splice(next->handles_.begin(), current->handles_, pos.self_);
+        pos.bucket_ = next;
+        if (current->handles_.empty())
+            buckets_.erase(current);
+    }
+
+    void on_erase(storage_type&, handle_t handle)
+    {
+        auto iter = positions_.find(handle);
+        if (iter == positions_.end())
+            return;
+
+        auto current = iter->second.bucket_;
+        current->handles_.erase(iter->second.self_);
+        if (current->handles_.empty())
+            buckets_.erase(current);
+        positions_.erase(iter);
+        if (has_newest_ && newest_ == handle)
+            has_newest_ = false;
+    }
+
+    // victim runs after the insert: an entry just inserted would always be
+    // the least frequent one, it only goes if nothing else is left.
+    handle_t victim(storage_type& entries)
+    {
+        if (buckets_.empty())
+            return entries.end();
+
+        auto first = buckets_.begin();
+        const bool only_newest = first->handles_.size() == 1 && has_newest_ && first->handles_.front() == newest_;
+        if (only_newest && std::next(first) != buckets_.end())
+            ++first;
+        return first->handles_.back();
+    }
+};
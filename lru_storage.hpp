@@ -0,0 +1,804 @@
+#pragma once
+
+#include "head.hpp"
+#include "bench.hpp"
+
+#include <malloc.h>
+#include <string>
+#include <string_view>
+
+// Storage engines for the LRU caches. A storage owns the nodes, keeps them
+// in recency order (front = most recently used) and indexes them by key.
+// node_t must expose its key as `key_`. The nodes are split over a few
+// recency lists, the segments, for policies that keep more than one queue
+// (a new node goes to segment 0, plain LRU never uses the others). Both
+// engines share one interface:
+//
+//   key_type / handle_t
+//   segments                            number of recency lists
+//   handle_t end()                      invalid handle
+//   handle_t find(key)                  end() if absent, key may be any type
+//   bool     contains(key)               key_t compares with (string_view...)
+//   void     find_batch(keys, count, handles)   find for an array of key pointers
+//   node_t&  at(handle)
+//   handle_t emplace_front(args...)     key must not be present
+//   void     move_to_front(handle)      front of the node's segment
+//   void     move_to_front(handle, segment)     front of another segment
+//   uint32_t segment(handle)
+//   handle_t front(segment = 0) / back(segment = 0) / next(handle)
+//   void     erase(handle)
+//   void     detach(handle)             unindex and unlink, the node stays
+//   void     release(handle)            valid until release(handle)
+//   void     rekey(handle, key)         reuse a node for another key
+//   size()  size(segment)  empty()  clear()  reserve(n)
+//
+// Nodes never move, a node's address is valid until it is erased or
+// released. size() and clear() ignore detached nodes.
+
+// key_hash is std::hash, made transparent for string keys: a std::string
+// key can be looked up by std::string_view or const char* without building
+// a std::string, they all hash alike.
+template<typename key_t>
+struct key_hash : std::hash<key_t>
+{
+};
+
+template<>
+struct key_hash<std::string>
+{
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view key) const
+    {
+        return std::hash<std::string_view>()(key);
+    }
+};
+
+/// <summary>
+/// list_storage keeps each segment in a std::list indexed by an
+/// unordered_map. Every insert allocates a list node and a map node.
+/// </summary>
+template<typename key_t, typename node_t>
+class list_storage
+{
+public:
+    using key_type = key_t;
+
+    static const uint32_t segments = 4;
+
+private:
+    // item_t remembers its list position, so a handle can be a plain pointer
+    // that is valid across segments.
+    struct item_t
+    {
+        node_t node_;
+        uint32_t segment_{0};
+        typename std::list<item_t>::iterator self_;
+
+        template<typename... TArgs>
+        explicit item_t(TArgs&&... args)
+            : node_(std::forward<TArgs>(args)...)
+        {
+        }
+    };
+
+public:
+    using handle_t = item_t*;
+
+private:
+    std::list<item_t> lists_[segments + 1];      // list store the real data, detached nodes last
+    std::unordered_map<key_t, handle_t, key_hash<key_t>, std::equal_to<>> map_; // map store the key-item pair
+
+public:
+    handle_t end() const
+    {
+        return nullptr;
+    }
+
+    template<typename K>
+    handle_t find(const K& key)
+    {
+        auto iter = map_.find(key);
+        return iter == map_.end() ? nullptr : iter->second;
+    }
+
+    template<typename K>
+    bool contains(const K& key) const
+    {
+        return map_.find(key) != map_.end();
+    }
+
+    void find_batch(const key_t* const* keys, std::size_t count, handle_t* handles)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            handles[i] = find(*keys[i]);
+        }
+    }
+
+    node_t& at(handle_t handle)
+    {
+        return handle->node_;
+    }
+
+    template<typename... TArgs>
+    handle_t emplace_front(TArgs&&... args)
+    {
+        auto& list = lists_[0];
+        list.emplace_front(std::forward<TArgs>(args)...);
+        list.front().self_ = list.begin();
+        map_.insert(std::make_pair(list.front().node_.key_, &list.front()));
+        return &list.front();
+    }
+
+    void move_to_front(handle_t handle)
+    {
+        if (handle != nullptr)
+            move_to_front(handle, handle->segment_);
+    }
+
+    void move_to_front(handle_t handle, uint32_t segment)
+    {
+        auto& list = lists_[segment];
+        if (handle == nullptr || (handle->segment_ == segment && handle->self_ == list.begin()))
+            return;
+
+        list.splice(list.begin(), lists_[handle->segment_], handle->self_);
+        handle->segment_ = segment;
+    }
+
+    uint32_t segment(handle_t handle) const
+    {
+        return handle->segment_;
+    }
+
+    handle_t front(uint32_t segment = 0)
+    {
+        return lists_[segment].empty() ? nullptr : &lists_[segment].front();
+    }
+
+    handle_t back(uint32_t segment = 0)
+    {
+        return lists_[segment].empty() ? nullptr : &lists_[segment].back();
+    }
+
+    handle_t next(handle_t handle)
+    {
+        auto iter = std::next(handle->self_);
+        return iter == lists_[handle->segment_].end() ? nullptr : &*iter;
+    }
+
+    void erase(handle_t handle)
+    {
+        map_.erase(handle->node_.key_);
+        lists_[handle->segment_].erase(handle->self_);
+    }
+
+    void detach(handle_t handle)
+    {
+        map_.erase(handle->node_.key_);
+        lists_[segments].splice(lists_[segments].begin(), lists_[handle->segment_], handle->self_);
+        handle->segment_ = segments;
+    }
+
+    void release(handle_t handle)
+    {
+        lists_[segments].erase(handle->self_);
+    }
+
+    void rekey(handle_t handle, const key_t& key)
+    {
+        map_.erase(handle->node_.key_);
+        handle->node_.key_ = key;
+        map_.insert(std::make_pair(key, handle));
+    }
+
+    std::size_t size() const
+    {
+        return map_.size();
+    }
+
+    std::size_t size(uint32_t segment) const
+    {
+        return lists_[segment].size();
+    }
+
+    bool empty() const
+    {
+        return map_.empty();
+    }
+
+    void clear()
+    {
+        for (uint32_t i = 0; i < segments; ++i)
+            lists_[i].clear();
+        map_.clear();
+    }
+
+    void reserve(std::size_t count)
+    {
+        map_.reserve(count);
+    }
+};
+
+template<typename key_t, typename node_t>
+const uint32_t list_storage<key_t, node_t>::segments;
+
+/// <summary>
+/// slab_storage keeps the nodes in a preallocated slab linked by 32-bit
+/// prev/next indices, indexed by a linear-probing hash table stored in a
+/// single contiguous array. The slab grows by chunks, each as large as all
+/// the previous ones, so nodes never move. Once the slab has grown to the
+/// working size, insert / lookup / evict never allocate.
+/// </summary>
+template<typename key_t, typename node_t>
+class slab_storage
+{
+public:
+    using key_type = key_t;
+    using handle_t = uint32_t;
+
+    static const uint32_t segments = 4;
+
+private:
+    static const uint32_t npos = 0xFFFFFFFFU;
+    static const uint32_t unused = 0xFFFFFFFEU; // prev_ of a slot on the free list
+    static const uint32_t detached = segments;  // list of the detached nodes
+    static const int max_chunks = 32;
+
+    struct slot_t
+    {
+        typename std::aligned_storage<sizeof(node_t), alignof(node_t)>::type node_;
+        uint32_t prev_;
+        uint32_t next_;
+        uint32_t hash_;
+        uint32_t segment_;
+    };
+
+    // hash_ doubles as a tag: most probes are rejected without touching the
+    // slot, and the home bucket is known without rehashing the key.
+    struct bucket_t
+    {
+        uint32_t slot_;
+        uint32_t hash_;
+    };
+
+    // chunk 0 holds slots [0, 2^base_bits_), chunk k > 0 holds
+    // [2^(base_bits_ + k - 1), 2^(base_bits_ + k)).
+    std::unique_ptr<slot_t[]> chunks_[max_chunks];
+    slot_t* base_{nullptr};   // chunks_[0]
+    std::size_t base_size_{0}; // not uint32_t, so slot stores cannot alias it
+    int chunk_count_{0};
+    int base_bits_{0};
+    std::unique_ptr<bucket_t[]> buckets_;
+    uint32_t slot_count_{0};  // slots in the slab
+    uint32_t used_{0};        // slots handed out at least once
+    uint32_t free_{npos};     // free list, linked through next_
+    uint32_t heads_[segments + 1];
+    uint32_t tails_[segments + 1];
+    uint32_t counts_[segments + 1]; // nodes per segment
+    uint32_t size_{0};
+    uint32_t mask_{0};        // bucket count - 1, zero before the first insert
+    key_hash<key_t> hasher_;
+
+public:
+    slab_storage()
+    {
+        reset_segments();
+    }
+
+    slab_storage(const slab_storage&) = delete;
+    slab_storage& operator=(const slab_storage&) = delete;
+
+    ~slab_storage()
+    {
+        destroy_all();
+    }
+
+    handle_t end() const
+    {
+        return npos;
+    }
+
+    template<typename K>
+    handle_t find(const K& key) const
+    {
+        if (size_ == 0)
+            return npos;
+
+        const uint32_t hash = hash_of(key);
+        for (uint32_t i = hash & mask_;; i = (i + 1) & mask_)
+        {
+            const bucket_t& bucket = buckets_[i];
+            if (bucket.slot_ == npos)
+                return npos;
+
+            if (bucket.hash_ == hash && node(bucket.slot_).key_ == key)
+                return bucket.slot_;
+        }
+    }
+
+    template<typename K>
+    bool contains(const K& key) const
+    {
+        return find(key) != npos;
+    }
+
+    // find_batch resolves keys in groups, in three passes: hash and prefetch
+    // the home buckets, probe the buckets by tag and prefetch the candidate
+    // slots, then compare the keys. The cache misses of a group overlap
+    // instead of being paid one lookup after another.
+    void find_batch(const key_t* const* keys, std::size_t count, handle_t* handles) const
+    {
+        const std::size_t group = 16;
+        uint32_t hashes[group];
+        uint32_t buckets[group];
+
+        for (std::size_t base = 0; base < count; base += group)
+        {
+            const std::size_t n = std::min(group, count - base);
+            if (size_ == 0)
+            {
+                std::fill(handles + base, handles + base + n, npos);
+                continue;
+            }
+
+            for (std::size_t j = 0; j < n; ++j)
+            {
+                hashes[j] = hash_of(*keys[base + j]);
+                __builtin_prefetch(&buckets_[hashes[j] & mask_]);
+            }
+
+            for (std::size_t j = 0; j < n; ++j)
+            {
+                uint32_t i = hashes[j] & mask_;
+                while (buckets_[i].slot_ != npos && buckets_[i].hash_ != hashes[j])
+                {
+                    i = (i + 1) & mask_;
+                }
+                buckets[j] = i;
+                if (buckets_[i].slot_ != npos)
+                {
+                    __builtin_prefetch(&slot(buckets_[i].slot_));
+                }
+            }
+
+            for (std::size_t j = 0; j < n; ++j)
+            {
+                const uint32_t slot = buckets_[buckets[j]].slot_;
+                if (slot == npos)
+                {
+                    handles[base + j] = npos;
+                }
+                else if (node(slot).key_ == *keys[base + j])
+                {
+                    handles[base + j] = slot;
+                }
+                else
+                {
+                    // 32-bit tag collision, fall back to the full probe
+                    handles[base + j] = find(*keys[base + j]);
+                }
+            }
+        }
+    }
+
+    node_t& at(handle_t handle)
+    {
+        return node(handle);
+    }
+
+    template<typename... TArgs>
+    handle_t emplace_front(TArgs&&... args)
+    {
+        const uint32_t s = alloc_slot();
+        new (&slot(s).node_) node_t(std::forward<TArgs>(args)...);
+        slot(s).hash_ = hash_of(node(s).key_);
+        size_++;
+        index_insert(s);
+        link_front(s, 0);
+        return s;
+    }
+
+    void move_to_front(handle_t handle)
+    {
+        if (handle != npos)
+            move_to_front(handle, slot(handle).segment_);
+    }
+
+    void move_to_front(handle_t handle, uint32_t segment)
+    {
+        if (handle == heads_[segment] || handle == npos)
+            return;
+
+        unlink(handle);
+        link_front(handle, segment);
+    }
+
+    uint32_t segment(handle_t handle) const
+    {
+        return slot(handle).segment_;
+    }
+
+    handle_t front(uint32_t segment = 0) const
+    {
+        return heads_[segment];
+    }
+
+    handle_t back(uint32_t segment = 0) const
+    {
+        return tails_[segment];
+    }
+
+    handle_t next(handle_t handle) const
+    {
+        return slot(handle).next_;
+    }
+
+    void erase(handle_t handle)
+    {
+        index_erase(handle);
+        unlink(handle);
+        node(handle).~node_t();
+        free_slot(handle);
+        size_--;
+    }
+
+    void detach(handle_t handle)
+    {
+        index_erase(handle);
+        unlink(handle);
+        link_front(handle, detached);
+        size_--;
+    }
+
+    void release(handle_t handle)
+    {
+        unlink(handle);
+        node(handle).~node_t();
+        free_slot(handle);
+    }
+
+    void rekey(handle_t handle, const key_t& key)
+    {
+        index_erase(handle);
+        node(handle).key_ = key;
+        slot(handle).hash_ = hash_of(key);
+        index_insert(handle);
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    std::size_t size(uint32_t segment) const
+    {
+        return counts_[segment];
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    void clear()
+    {
+        if (counts_[detached] > 0)
+        {
+            // the detached nodes keep their slots, free the others one by one
+            for (uint32_t segment = 0; segment < segments; ++segment)
+            {
+                while (heads_[segment] != npos)
+                {
+                    erase(heads_[segment]);
+                }
+            }
+            return;
+        }
+
+        destroy_all();
+        used_ = 0;
+        free_ = npos;
+        reset_segments();
+        size_ = 0;
+        for (uint32_t i = 0; mask_ != 0 && i <= mask_; ++i)
+        {
+            buckets_[i].slot_ = npos;
+        }
+    }
+
+    // reserve preallocates the slab and the index for `count` nodes.
+    void reserve(std::size_t count)
+    {
+        if (count > slot_count_)
+        {
+            grow_slab(static_cast<uint32_t>(count));
+        }
+        if (count * 2 > static_cast<std::size_t>(mask_) + 1 || mask_ == 0)
+        {
+            rehash(static_cast<uint32_t>(count * 2));
+        }
+    }
+
+private:
+    template<typename K>
+    uint32_t hash_of(const K& key) const
+    {
+        return static_cast<uint32_t>(mix_hash(hasher_(key)));
+    }
+
+    slot_t& slot(uint32_t s) const
+    {
+        return __builtin_expect(s < base_size_, 1) ? base_[s] : chunk_slot(s);
+    }
+
+    // chunk_slot finds slots past the first chunk, kept out of line so the
+    // common case inlines to a compare and an index.
+    __attribute__((noinline)) slot_t& chunk_slot(uint32_t s) const
+    {
+        const int k = 32 - __builtin_clz(s >> base_bits_);
+        return chunks_[k][s - (1U << (base_bits_ + k - 1))];
+    }
+
+    node_t& node(uint32_t s) const
+    {
+        return *reinterpret_cast<node_t*>(&slot(s).node_);
+    }
+
+    uint32_t alloc_slot()
+    {
+        if (free_ != npos)
+        {
+            uint32_t s = free_;
+            free_ = slot(s).next_;
+            return s;
+        }
+
+        if (used_ == slot_count_)
+        {
+            grow_slab(slot_count_ + 1);
+        }
+        if ((size_ + 1) * 2 > mask_ + 1 || mask_ == 0)
+        {
+            rehash((size_ + 1) * 2);
+        }
+        return used_++;
+    }
+
+    void free_slot(uint32_t s)
+    {
+        slot(s).prev_ = unused;
+        slot(s).next_ = free_;
+        free_ = s;
+    }
+
+    void reset_segments()
+    {
+        for (uint32_t i = 0; i <= segments; ++i)
+        {
+            heads_[i] = tails_[i] = npos;
+            counts_[i] = 0;
+        }
+    }
+
+    void link_front(uint32_t s, uint32_t segment)
+    {
+        uint32_t& head = heads_[segment];
+        slot_t& node = slot(s);
+        node.segment_ = segment;
+        node.prev_ = npos;
+        node.next_ = head;
+        if (head != npos)
+            slot(head).prev_ = s;
+        head = s;
+        if (tails_[segment] == npos)
+            tails_[segment] = s;
+        counts_[segment]++;
+    }
+
+    void unlink(uint32_t s)
+    {
+        const slot_t& node = slot(s);
+        const uint32_t segment = node.segment_;
+        const uint32_t prev = node.prev_;
+        const uint32_t next = node.next_;
+        if (prev != npos)
+            slot(prev).next_ = next;
+        else
+            heads_[segment] = next;
+        if (next != npos)
+            slot(next).prev_ = prev;
+        else
+            tails_[segment] = prev;
+        counts_[segment]--;
+    }
+
+    void index_insert(uint32_t s)
+    {
+        const uint32_t hash = slot(s).hash_;
+        uint32_t i = hash & mask_;
+        while (buckets_[i].slot_ != npos)
+        {
+            i = (i + 1) & mask_;
+        }
+        buckets_[i].slot_ = s;
+        buckets_[i].hash_ = hash;
+    }
+
+    // index_erase removes the slot with backward-shift deletion, so the
+    // table never accumulates tombstones.
+    void index_erase(uint32_t s)
+    {
+        uint32_t i = slot(s).hash_ & mask_;
+        while (buckets_[i].slot_ != s)
+        {
+            i = (i + 1) & mask_;
+        }
+
+        for (uint32_t j = (i + 1) & mask_; buckets_[j].slot_ != npos; j = (j + 1) & mask_)
+        {
+            const uint32_t home = buckets_[j].hash_ & mask_;
+            // move bucket j back into the hole unless its home lies in (i, j]
+            const bool in_range = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+            if (!in_range)
+            {
+                buckets_[i] = buckets_[j];
+                i = j;
+            }
+        }
+        buckets_[i].slot_ = npos;
+    }
+
+    // grow_slab adds chunks until the slab holds `count` slots. The first
+    // chunk is sized to the first request, rounded up to a power of two.
+    void grow_slab(uint32_t count)
+    {
+        if (chunk_count_ == 0)
+        {
+            base_bits_ = 3;
+            while ((1U << base_bits_) < count)
+            {
+                base_bits_++;
+            }
+            chunks_[0].reset(new slot_t[1U << base_bits_]);
+            base_ = chunks_[0].get();
+            base_size_ = 1U << base_bits_;
+            chunk_count_ = 1;
+            slot_count_ = 1U << base_bits_;
+        }
+
+        while (slot_count_ < count)
+        {
+            chunks_[chunk_count_++].reset(new slot_t[slot_count_]);
+            slot_count_ *= 2;
+        }
+    }
+
+    void rehash(uint32_t count)
+    {
+        uint32_t buckets = 16;
+        while (buckets < count)
+        {
+            buckets <<= 1;
+        }
+
+        buckets_.reset(new bucket_t[buckets]);
+        mask_ = buckets - 1;
+        for (uint32_t i = 0; i < buckets; ++i)
+        {
+            buckets_[i].slot_ = npos;
+        }
+        for (uint32_t segment = 0; segment < segments; ++segment)
+        {
+            for (uint32_t s = heads_[segment]; s != npos; s = slot(s).next_)
+            {
+                index_insert(s);
+            }
+        }
+    }
+
+    void destroy_all()
+    {
+        for (uint32_t segment = 0; segment <= segments; ++segment)
+        {
+            for (uint32_t s = heads_[segment]; s != npos; s = slot(s).next_)
+            {
+                node(s).~node_t();
+            }
+        }
+    }
+};
+
+template<typename key_t, typename node_t>
+const uint32_t slab_storage<key_t, node_t>::npos;
+
+template<typename key_t, typename node_t>
+const uint32_t slab_storage<key_t, node_t>::unused;
+
+template<typename key_t, typename node_t>
+const uint32_t slab_storage<key_t, node_t>::segments;
+
+template<typename key_t, typename node_t>
+const uint32_t slab_storage<key_t, node_t>::detached;
+
+template<typename key_t, typename node_t>
+const int slab_storage<key_t, node_t>::max_chunks;
+
+/////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////
+struct storage_bench_node
+{
+    int64_t key_;
+    int64_t value_;
+
+    storage_bench_node(int64_t key, int64_t value)
+        : key_(key)
+        , value_(value)
+    {
+    }
+};
+
+// storage_bench measures, for one storage engine: bytes per entry (heap
+// growth reported by malloc), hit cost (find + move_to_front) and miss cost
+// (failed find + evict the tail + insert). Keys are scrambled, sequential
+// integers would be a best case for std::hash's identity mapping.
+inline size_t heap_in_use()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd; // small chunks + mmapped chunks
+}
+
+template<template<typename, typename> class storage_t>
+void storage_bench(const char* name, int capacity, int ops)
+{
+    const size_t before = heap_in_use();
+    storage_t<int64_t, storage_bench_node> storage;
+    storage.reserve(capacity);
+    for (int64_t i = 0; i < capacity; ++i)
+    {
+        storage.emplace_front(static_cast<int64_t>(mix_hash(i)), i);
+    }
+    const size_t after = heap_in_use();
+
+    int64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i)
+    {
+        auto handle = storage.find(static_cast<int64_t>(mix_hash(fast_rand() % capacity)));
+        storage.move_to_front(handle);
+        sum += storage.at(handle).value_;
+    }
+    auto hit = std::chrono::steady_clock::now() - start;
+
+    int64_t next_key = capacity;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i, ++next_key)
+    {
+        const int64_t key = static_cast<int64_t>(mix_hash(next_key));
+        if (storage.find(key) == storage.end())
+        {
+            storage.erase(storage.back());
+            storage.emplace_front(key, next_key);
+        }
+    }
+    auto miss = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << "\tbytes/entry = " << static_cast<double>(after - before) / capacity
+              << "\thit = " << std::chrono::duration_cast<std::chrono::nanoseconds>(hit).count() / ops << " ns"
+              << "\tmiss+evict = " << std::chrono::duration_cast<std::chrono::nanoseconds>(miss).count() / ops
+              << " ns\t(" << sum % 10 << ")" << std::endl;
+}
+
+void lru_storage_bench()
+{
+    std::cout << "-------------------LRU storage bench---------------------" << std::endl;
+    const int ops = 1000000;
+    int capacities[] = {1 << 10, 1 << 16, 1 << 20};
+    for (int capacity : capacities)
+    {
+        std::cout << "capacity = " << capacity << std::endl;
+        storage_bench<list_storage>("list_storage", capacity, ops);
+        storage_bench<slab_storage>("slab_storage", capacity, ops);
+    }
+}
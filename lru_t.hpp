@@ -1,67 +1,295 @@
 #pragma once
 
 #include "head.hpp"
+#include "lru.hpp"
 
-template<typename key_t, typename value_t>
+#include <limits>
+#include <optional>
+
+/// <summary>
+/// lru_cache is the small put/get interface over LruCache, without TTLs. The
+/// eviction order is the policy's, LRU by default.
+/// </summary>
+template<typename key_t, typename value_t, template<typename, typename> class storage_t = list_storage,
+    template<typename> class policy_t = lru_policy>
 class lru_cache
 {
-public:
-    typedef typename std::pair<key_t, value_t> key_value_pair_t;
-    typedef typename std::list<key_value_pair_t>::iterator list_iterator_t;
-
 private:
-    std::list<key_value_pair_t> _cache_items_list;
-    std::unordered_map<key_t, list_iterator_t> _cache_items_map;
-    size_t _max_size;
+    mutable LruCache<key_t, value_t, storage_t, policy_t> cache_;
 
 public:
     lru_cache(size_t max_size)
-        : _max_size(max_size)
+        : cache_(static_cast<int64_t>(max_size))
     {
     }
 
     void put(const key_t& key, const value_t& value)
     {
-        auto it = _cache_items_map.find(key);
-        _cache_items_list.push_front(key_value_pair_t(key, value));
-        if (it != _cache_items_map.end())
+        cache_.Set(key, value);
+    }
+
+    // get returns a copy of the value, the cache may be shared between
+    // threads.
+    value_t get(const key_t& key)
+    {
+        value_t value;
+        if (!cache_.Get(key, value))
+        {
+            throw std::range_error("There is no such key in cache");
+        }
+        return value;
+    }
+
+    bool exists(const key_t& key) const
+    {
+        return cache_.IsExist(key);
+    }
+
+    size_t size() const
+    {
+        return static_cast<size_t>(cache_.Length());
+    }
+};
+
+/// <summary>
+/// fixed_lru_cache is a single-threaded LRU cache of at most Capacity
+/// entries whose storage is all inline: a node array and an open-addressing
+/// index (linear probing, at most half full, backward-shift deletion). It
+/// never allocates, so it can sit on the stack or inside a per-connection
+/// struct. Keys and values must be default constructible; an evicted value
+/// is only overwritten when its node is reused.
+/// </summary>
+template<typename key_t, typename value_t, std::size_t Capacity, typename hash_t = key_hash<key_t>>
+class fixed_lru_cache
+{
+    static_assert(Capacity > 0 && Capacity < (std::size_t(1) << 31), "Capacity out of range");
+
+private:
+    using index_t = typename std::conditional<(Capacity < 0xFFFF), uint16_t, uint32_t>::type;
+
+    static constexpr index_t npos = std::numeric_limits<index_t>::max();
+
+    static constexpr std::size_t table_size()
+    {
+        std::size_t size = 8;
+        while (size < 2 * Capacity)
+            size <<= 1;
+        return size;
+    }
+
+    static constexpr std::size_t mask = table_size() - 1;
+
+    struct node
+    {
+        key_t key_;
+        value_t value_;
+        uint32_t hash_;
+        index_t prev_;
+        index_t next_; // next in LRU order, or in the free list
+    };
+
+    node nodes_[Capacity];
+    index_t table_[table_size()]; // node of each bucket, npos if empty
+    index_t head_{npos};          // most recently used
+    index_t tail_{npos};
+    index_t free_{npos};          // erased nodes
+    index_t used_{0};             // nodes ever used, the rest are fresh
+    index_t size_{0};
+    hash_t hasher_;
+
+public:
+    fixed_lru_cache()
+    {
+        clear();
+    }
+
+    static constexpr std::size_t capacity()
+    {
+        return Capacity;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    // get copies the value out and marks the entry as most recently used.
+    bool get(const key_t& key, value_t& value)
+    {
+        value_t* found = find(key);
+        if (found == nullptr)
+            return false;
+
+        value = *found;
+        return true;
+    }
+
+    std::optional<value_t> get(const key_t& key)
+    {
+        value_t* found = find(key);
+        if (found == nullptr)
+            return std::nullopt;
+        return *found;
+    }
+
+    // find returns the cached value in place, valid until the next put,
+    // erase or clear, and marks the entry as most recently used.
+    value_t* find(const key_t& key)
+    {
+        const uint32_t hash = hash_of(key);
+        const index_t slot = table_[locate(key, hash)];
+        if (slot == npos)
+            return nullptr;
+
+        move_to_front(slot);
+        return &nodes_[slot].value_;
+    }
+
+    bool exists(const key_t& key) const
+    {
+        return table_[locate(key, hash_of(key))] != npos;
+    }
+
+    // put sets a value, evicting the least recently used entry when full.
+    void put(const key_t& key, value_t value)
+    {
+        const uint32_t hash = hash_of(key);
+        std::size_t pos = locate(key, hash);
+        index_t slot = table_[pos];
+        if (slot != npos)
         {
-            _cache_items_list.erase(it->second);
-            _cache_items_map.erase(it);
+            nodes_[slot].value_ = std::move(value);
+            move_to_front(slot);
+            return;
         }
-        _cache_items_map[key] = _cache_items_list.begin();
 
-        if (_cache_items_map.size() > _max_size)
+        if (free_ != npos)
         {
-            auto last = _cache_items_list.end();
-            last--;
-            _cache_items_map.erase(last->first);
-            _cache_items_list.pop_back();
+            slot = free_;
+            free_ = nodes_[slot].next_;
         }
+        else if (used_ < Capacity)
+        {
+            slot = used_++;
+        }
+        else
+        {
+            // evicting shifts the index, the new key's bucket moves
+            slot = tail_;
+            unindex(slot);
+            unlink(slot);
+            size_--;
+            pos = locate(key, hash);
+        }
+
+        node& n = nodes_[slot];
+        n.key_ = key;
+        n.value_ = std::move(value);
+        n.hash_ = hash;
+        table_[pos] = slot;
+        link_front(slot);
+        size_++;
+    }
+
+    bool erase(const key_t& key)
+    {
+        const index_t slot = table_[locate(key, hash_of(key))];
+        if (slot == npos)
+            return false;
+
+        unindex(slot);
+        unlink(slot);
+        nodes_[slot].next_ = free_;
+        free_ = slot;
+        size_--;
+        return true;
+    }
+
+    void clear()
+    {
+        std::fill(std::begin(table_), std::end(table_), npos);
+        head_ = tail_ = free_ = npos;
+        used_ = size_ = 0;
+    }
+
+private:
+    uint32_t hash_of(const key_t& key) const
+    {
+        return static_cast<uint32_t>(mix_hash(hasher_(key)));
     }
 
-    const value_t& get(const key_t& key)
+    // locate returns the bucket holding key, or the empty bucket ending its
+    // probe sequence.
+    std::size_t locate(const key_t& key, uint32_t hash) const
     {
-        auto it = _cache_items_map.find(key);
-        if (it == _cache_items_map.end())
+        std::size_t pos = hash & mask;
+        while (table_[pos] != npos && !(nodes_[table_[pos]].hash_ == hash && nodes_[table_[pos]].key_ == key))
         {
-            throw std::range_error("There is no such key in cache");
+            pos = (pos + 1) & mask;
         }
-        else
+        return pos;
+    }
+
+    // unindex removes a node from the index, moving back the entries after
+    // it that would otherwise be cut off from their home bucket.
+    void unindex(index_t slot)
+    {
+        std::size_t hole = nodes_[slot].hash_ & mask;
+        while (table_[hole] != slot)
+        {
+            hole = (hole + 1) & mask;
+        }
+
+        for (std::size_t pos = (hole + 1) & mask; table_[pos] != npos; pos = (pos + 1) & mask)
         {
-            _cache_items_list.splice(_cache_items_list.begin(), _cache_items_list, it->second);
-            return it->second->second;
+            const std::size_t home = nodes_[table_[pos]].hash_ & mask;
+            // does home lie cyclically in (hole, pos]? then the entry stays
+            const bool stays = hole <= pos ? (hole < home && home <= pos) : (hole < home || home <= pos);
+            if (!stays)
+            {
+                table_[hole] = table_[pos];
+                hole = pos;
+            }
         }
+        table_[hole] = npos;
     }
 
-    bool exists(const key_t& key) const
+    void link_front(index_t slot)
     {
-        return _cache_items_map.find(key) != _cache_items_map.end();
+        nodes_[slot].prev_ = npos;
+        nodes_[slot].next_ = head_;
+        if (head_ != npos)
+            nodes_[head_].prev_ = slot;
+        head_ = slot;
+        if (tail_ == npos)
+            tail_ = slot;
     }
 
-    size_t size() const
+    void unlink(index_t slot)
     {
-        return _cache_items_map.size();
+        node& n = nodes_[slot];
+        if (n.prev_ != npos)
+            nodes_[n.prev_].next_ = n.next_;
+        else
+            head_ = n.next_;
+        if (n.next_ != npos)
+            nodes_[n.next_].prev_ = n.prev_;
+        else
+            tail_ = n.prev_;
+    }
+
+    void move_to_front(index_t slot)
+    {
+        if (slot == head_)
+            return;
+
+        unlink(slot);
+        link_front(slot);
     }
 };
 
@@ -76,4 +304,83 @@ void lru_t_test()
     lru_.put(6, 6);
     std::cout << "-------------------lru_t cache---------------------" << std::endl;
     std::cout << lru_.size() << std::endl;
+
+    lru_cache<int, int, slab_storage> slab_lru_(4);
+    for (int i = 0; i < 6; ++i)
+    {
+        slab_lru_.put(i, i * i);
+    }
+    std::cout << "slab_storage : size = " << slab_lru_.size() << ", exists(1) = " << slab_lru_.exists(1)
+              << ", get(5) = " << slab_lru_.get(5) << std::endl;
+
+    lru_cache<int, int, slab_storage, arc_policy> arc_lru_(4);
+    for (int i = 0; i < 6; ++i)
+    {
+        arc_lru_.put(i, i);
+    }
+    std::cout << "arc_policy : size = " << arc_lru_.size() << ", exists(5) = " << arc_lru_.exists(5) << std::endl;
+
+    fixed_lru_cache<int, int, 4> fixed_lru_;
+    for (int i = 0; i < 6; ++i)
+    {
+        fixed_lru_.put(i, i * i);
+    }
+    fixed_lru_.erase(4);
+    std::cout << "fixed_lru_cache : size = " << fixed_lru_.size() << ", get(1) = " << fixed_lru_.get(1).has_value()
+              << ", get(5) = " << fixed_lru_.get(5).value_or(-1) << std::endl;
+}
+
+// fixed_lru_bench_at times get-or-put over 2 * Capacity keys, a hit ratio of
+// about a half, on fixed_lru_cache and on lru_cache (whose get throws on a
+// miss).
+template<std::size_t Capacity>
+void fixed_lru_bench_at()
+{
+    const int ops = 1000000;
+    const uint32_t keys = 2 * Capacity;
+    std::vector<int> trace(ops);
+    for (int& key : trace)
+    {
+        key = static_cast<int>(fast_rand() % keys);
+    }
+
+    static fixed_lru_cache<int, int, Capacity> fixed;
+    fixed.clear();
+    int64_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int key : trace)
+    {
+        if (int* value = fixed.find(key))
+            hits += *value == key ? 1 : 0;
+        else
+            fixed.put(key, key);
+    }
+    auto elapsed_fixed = std::chrono::steady_clock::now() - start;
+
+    lru_cache<int, int, slab_storage> dynamic(Capacity);
+    start = std::chrono::steady_clock::now();
+    for (int key : trace)
+    {
+        try
+        {
+            hits += dynamic.get(key) == key ? 1 : 0;
+        }
+        catch (const std::range_error&)
+        {
+            dynamic.put(key, key);
+        }
+    }
+    auto elapsed_dynamic = std::chrono::steady_clock::now() - start;
+
+    std::cout << "capacity = " << Capacity << "\tfixed_lru_cache = " << elapsed_fixed.count() / ops
+              << "\tlru_cache = " << elapsed_dynamic.count() / ops << "\t(" << hits % 10 << ")" << std::endl;
+}
+
+void fixed_lru_bench()
+{
+    std::cout << "-------------------fixed_lru_cache vs lru_cache (ns/op)---------------------" << std::endl;
+    fixed_lru_bench_at<8>();
+    fixed_lru_bench_at<64>();
+    fixed_lru_bench_at<512>();
+    fixed_lru_bench_at<4096>();
 }
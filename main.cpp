@@ -1,14 +1,18 @@
 #include "any.hpp"
+#include "concurrent_lru.hpp"
 #include "kmp.hpp"
 #include "lru.hpp"
 #include "lru_t.hpp"
 #include "redpacket.hpp"
 #include "search.hpp"
+#include "sharded_lru.hpp"
 #include "shuffle.hpp"
 #include "singleton.hpp"
 #include "sort.hpp"
 #include "waitgroup.hpp"
 #include "timer.hpp"
+#include "timer_service.hpp"
+#include "thread_pool.hpp"
 
 class MyClass
 {
@@ -80,8 +84,42 @@ void test_map()
     }
 }
 
-int main()
+// bench runs the benchmarks instead of the tests: `demo bench [trace-file]`
+// where the optional trace file adds a recorded trace to the hit-ratio runs.
+void bench(const std::string& trace_path)
 {
+    sharded_lru_bench();
+    concurrent_lru_bench();
+    lru_storage_bench();
+    lru_clock_bench(trace_path);
+    lru_tinylfu_bench(trace_path);
+    lru_policy_bench(trace_path);
+    lru_copy_bench();
+    lru_batch_bench();
+    lru_expiry_bench();
+    lru_stats_bench();
+    lru_snapshot_bench();
+    fixed_lru_bench();
+    timer_bench();
+    timer_slack_bench();
+    timer_coroutine_bench();
+    timer_service_bench();
+    wait_group_bench();
+    thread_pool_bench();
+    sort_bench();
+    parallel_sort_bench();
+    parallel_kmp_bench();
+    singleton_bench();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "bench")
+    {
+        bench(argc > 2 ? argv[2] : "");
+        return 0;
+    }
+
     test_map();
 
     shuffle_test();
@@ -92,8 +130,13 @@ int main()
 
     lru_t_test();
     lru_test();
+    sharded_lru_test();
+    concurrent_lru_test();
 
     timer_test();
+    timer_service_test();
+    thread_pool_test();
+    singleton_test();
 
     wait_group_test();
 }
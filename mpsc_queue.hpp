@@ -0,0 +1,86 @@
+#pragma once
+
+#include "head.hpp"
+#include "singleton.hpp"
+
+// mpsc_node is the link an item needs to go through an mpsc_queue.
+struct mpsc_node
+{
+    std::atomic<mpsc_node*> next_{nullptr};
+};
+
+/// <summary>
+/// mpsc_queue is an intrusive multi-producer single-consumer queue (Vyukov's
+/// algorithm): push is one exchange and one store, wait-free, from any
+/// thread; pop is for one consumer thread only and never blocks. Items
+/// derive from mpsc_node and stay owned by the caller.
+/// </summary>
+template<typename T>
+class mpsc_queue : public Noncopyable
+{
+private:
+    std::atomic<mpsc_node*> head_; // last pushed
+    mpsc_node* tail_;              // next to pop, consumer only
+    mpsc_node stub_;
+
+public:
+    mpsc_queue()
+        : head_(&stub_)
+        , tail_(&stub_)
+    {
+    }
+
+    void push(T* item)
+    {
+        link(item);
+    }
+
+    // pop returns the oldest item, or nullptr if the queue is empty or the
+    // only item is still being pushed.
+    T* pop()
+    {
+        mpsc_node* tail = tail_;
+        mpsc_node* next = tail->next_.load(std::memory_order_acquire);
+        if (tail == &stub_)
+        {
+            if (next == nullptr)
+                return nullptr;
+
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+        if (next != nullptr)
+        {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+
+        // tail is the last item: put the stub behind it before taking it
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+
+        link(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return nullptr;
+
+        tail_ = next;
+        return static_cast<T*>(tail);
+    }
+
+    // empty is true if nothing has been pushed since the queue was last
+    // drained, pushes in progress included. Consumer only.
+    bool empty() const
+    {
+        return tail_ == &stub_ && head_.load(std::memory_order_seq_cst) == &stub_;
+    }
+
+private:
+    void link(mpsc_node* node)
+    {
+        node->next_.store(nullptr, std::memory_order_relaxed);
+        mpsc_node* prev = head_.exchange(node, std::memory_order_seq_cst);
+        prev->next_.store(node, std::memory_order_release);
+    }
+};
@@ -0,0 +1,535 @@
+#pragma once
+
+#include "head.hpp"
+#include "bench.hpp"
+#include "lru.hpp"
+
+/// <summary>
+/// ShardedLruCache hashes keys onto N independent LruCache shards. Every shard
+/// has its own lock, list and map, so operations on different shards never
+/// contend. The global capacity is split across the shards.
+/// </summary>
+/// <typeparam name="key_t"></typeparam>
+/// <typeparam name="value_t"></typeparam>
+/// <typeparam name="N">number of shards</typeparam>
+/// <typeparam name="shard_t">cache used for every shard</typeparam>
+template<typename key_t, typename value_t, std::size_t N, typename shard_t = LruCache<key_t, value_t>>
+class ShardedLruCache
+{
+    static_assert(N > 0, "ShardedLruCache needs at least one shard");
+
+private:
+    // trailing padding keeps two shards' locks off the same cache line.
+    struct padded_shard
+    {
+        shard_t shard_;
+        char padding_[64];
+
+        padded_shard(int64_t capacity, std::chrono::seconds ttl)
+            : shard_(capacity, ttl)
+        {
+        }
+    };
+
+    // shard_groups orders batch positions by shard: positions of shard s are
+    // index_[offsets_[s] .. offsets_[s + 1]).
+    struct shard_groups
+    {
+        std::vector<uint32_t> shard_of_;
+        std::vector<uint32_t> index_;
+        std::size_t offsets_[N + 1];
+    };
+
+    std::unique_ptr<padded_shard> shards_[N];
+    key_hash<key_t> hasher_;
+    std::chrono::seconds ttl_;
+
+public:
+    ShardedLruCache(int64_t capacity, std::chrono::seconds ttl = std::chrono::seconds(-1))
+        : ttl_(ttl)
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            shards_[i].reset(new padded_shard(shard_capacity(capacity, i), ttl));
+        }
+    }
+
+    // Get returns a value from the cache, and marks the entry as most recently
+    // used.
+    template<typename K>
+    bool Get(const K& key, value_t& value)
+    {
+        return shard(key).Get(key, value);
+    }
+
+    // Pin returns a handle reading the value in place, see LruCache::Pinned.
+    template<typename K>
+    typename shard_t::Pinned Pin(const K& key)
+    {
+        return shard(key).Pin(key);
+    }
+
+    // MultiGet groups the keys by shard and issues one batched lookup per
+    // shard, so every shard lock is taken once per batch. found[i] tells
+    // whether values[i] was filled; returns the number of hits.
+    size_t MultiGet(const key_t* keys, size_t count, value_t* values, bool* found)
+    {
+        const auto& groups = group_by_shard(keys, count, [](const key_t& key) -> const key_t& { return key; });
+        size_t hits = 0;
+        for (std::size_t s = 0; s < N; ++s)
+        {
+            if (groups.offsets_[s + 1] > groups.offsets_[s])
+            {
+                hits += shards_[s]->shard_.MultiGet(keys, groups.index_.data() + groups.offsets_[s],
+                    groups.offsets_[s + 1] - groups.offsets_[s], values, found);
+            }
+        }
+        return hits;
+    }
+
+    // MultiGet resizes values and found to keys.size().
+    size_t MultiGet(const std::vector<key_t>& keys, std::vector<value_t>& values, std::vector<bool>& found)
+    {
+        std::unique_ptr<bool[]> found_buf(new bool[keys.size()]);
+        values.resize(keys.size());
+        size_t hits = MultiGet(keys.data(), keys.size(), values.data(), found_buf.get());
+        found.assign(found_buf.get(), found_buf.get() + keys.size());
+        return hits;
+    }
+
+    // Peek returns a value from the cache without changing the LRU order.
+    template<typename K>
+    bool Peek(const K& key, value_t& value)
+    {
+        return shard(key).Peek(key, value);
+    }
+
+    // GetOrLoad returns the cached value or loads it, one load per key at a time.
+    template<typename F>
+    value_t GetOrLoad(const key_t& key, F loader)
+    {
+        return shard(key).GetOrLoad(key, loader);
+    }
+
+    // IsExisted check whether a value is existed in the cache and not expired.
+    template<typename K>
+    bool IsExist(const K& key)
+    {
+        return shard(key).IsExist(key);
+    }
+
+    // SetWithTTL sets a value in the cache with a TTL.
+    void SetWithTTL(key_t key, value_t value, std::chrono::seconds ttl)
+    {
+        auto& s = shard(key);
+        s.SetWithTTL(std::move(key), std::move(value), ttl);
+    }
+
+    // Set sets a value in the cache with a TTL.
+    void Set(key_t key, value_t value)
+    {
+        auto& s = shard(key);
+        s.Set(std::move(key), std::move(value));
+    }
+
+    // SetWithCost sets a value charged `cost` against its shard's capacity.
+    void SetWithCost(key_t key, value_t value, int64_t cost, std::chrono::seconds ttl)
+    {
+        auto& s = shard(key);
+        s.SetWithCost(std::move(key), std::move(value), cost, ttl);
+    }
+
+    void SetWithCost(key_t key, value_t value, int64_t cost)
+    {
+        auto& s = shard(key);
+        s.SetWithCost(std::move(key), std::move(value), cost);
+    }
+
+    // MultiSetWithTTL sets the key/value pairs, one batch per shard.
+    void MultiSetWithTTL(const std::pair<key_t, value_t>* items, size_t count, std::chrono::seconds ttl)
+    {
+        const auto& groups = group_by_shard(
+            items, count, [](const std::pair<key_t, value_t>& item) -> const key_t& { return item.first; });
+        for (std::size_t s = 0; s < N; ++s)
+        {
+            if (groups.offsets_[s + 1] > groups.offsets_[s])
+            {
+                shards_[s]->shard_.MultiSetWithTTL(items, groups.index_.data() + groups.offsets_[s],
+                    groups.offsets_[s + 1] - groups.offsets_[s], ttl);
+            }
+        }
+    }
+
+    // MultiSet sets the key/value pairs with the default TTL.
+    void MultiSet(const std::pair<key_t, value_t>* items, size_t count)
+    {
+        MultiSetWithTTL(items, count, ttl_);
+    }
+
+    void MultiSet(const std::vector<std::pair<key_t, value_t>>& items)
+    {
+        MultiSet(items.data(), items.size());
+    }
+
+    // SetIfAbsent will set the value in the cache if not present.
+    void SetIfAbsent(key_t key, value_t value)
+    {
+        auto& s = shard(key);
+        s.SetIfAbsent(std::move(key), std::move(value));
+    }
+
+    // SetExpired will set an entry expired from the cache and returns if the
+    // entry existed.
+    template<typename K>
+    bool SetExpired(const K& key)
+    {
+        return shard(key).SetExpired(key);
+    }
+
+    // Delete removes an entry from the cache, and returns if the entry existed.
+    template<typename K>
+    bool Delete(const K& key)
+    {
+        return shard(key).Delete(key);
+    }
+
+    // MultiDelete removes the keys, one batch per shard, and returns how many
+    // entries existed.
+    size_t MultiDelete(const key_t* keys, size_t count)
+    {
+        const auto& groups = group_by_shard(keys, count, [](const key_t& key) -> const key_t& { return key; });
+        size_t deleted = 0;
+        for (std::size_t s = 0; s < N; ++s)
+        {
+            if (groups.offsets_[s + 1] > groups.offsets_[s])
+            {
+                deleted += shards_[s]->shard_.MultiDelete(
+                    keys, groups.index_.data() + groups.offsets_[s], groups.offsets_[s + 1] - groups.offsets_[s]);
+            }
+        }
+        return deleted;
+    }
+
+    size_t MultiDelete(const std::vector<key_t>& keys)
+    {
+        return MultiDelete(keys.data(), keys.size());
+    }
+
+    // Clear will clear every shard. Shards are cleared one after another, so
+    // concurrent writers may observe a partially cleared cache.
+    void Clear()
+    {
+        for (auto& s : shards_)
+        {
+            s->shard_.Clear();
+        }
+    }
+
+    // Length returns how many elements are in the cache
+    int64_t Length()
+    {
+        int64_t length = 0;
+        for (auto& s : shards_)
+        {
+            length += s->shard_.Length();
+        }
+        return length;
+    }
+
+    // Size returns the sum of the shards' Size().
+    int64_t Size()
+    {
+        int64_t size = 0;
+        for (auto& s : shards_)
+        {
+            size += s->shard_.Size();
+        }
+        return size;
+    }
+
+    // Capacity returns the cache maximum capacity.
+    int64_t Capacity()
+    {
+        int64_t capacity = 0;
+        for (auto& s : shards_)
+        {
+            capacity += s->shard_.Capacity();
+        }
+        return capacity;
+    }
+
+    // FreeSize returns the cache's free capacity.
+    int64_t FreeSize()
+    {
+        int64_t free_size = 0;
+        for (auto& s : shards_)
+        {
+            free_size += s->shard_.FreeSize();
+        }
+        return free_size;
+    }
+
+    // ReapExpired gives every shard the budget in turn, each shard lock is
+    // held for at most `budget` records. Returns the records looked at.
+    size_t ReapExpired(size_t budget)
+    {
+        size_t processed = 0;
+        for (auto& s : shards_)
+        {
+            processed += s->shard_.ReapExpired(budget);
+        }
+        return processed;
+    }
+
+    // SetReapBudget sets how many expiry records each write may reap.
+    void SetReapBudget(size_t budget)
+    {
+        for (auto& s : shards_)
+        {
+            s->shard_.SetReapBudget(budget);
+        }
+    }
+
+    // SetRefreshAhead sets every shard's GetOrLoad refresh-ahead window.
+    void SetRefreshAhead(std::chrono::seconds window)
+    {
+        for (auto& s : shards_)
+        {
+            s->shard_.SetRefreshAhead(window);
+        }
+    }
+
+    // SetCapacity splits the new capacity across the shards, shrinking the
+    // shards that exceed their part.
+    void SetCapacity(int64_t capacity)
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            shards_[i]->shard_.SetCapacity(shard_capacity(capacity, i));
+        }
+    }
+
+    // Stats sums the shards' counters and histograms; each shard counts on
+    // its own, so the shards never share a counter.
+    cache_stats Stats() const
+    {
+        cache_stats stats;
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            stats += shards_[i]->shard_.Stats();
+        }
+        return stats;
+    }
+
+    void SetLatencySampling(uint32_t every)
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            shards_[i]->shard_.SetLatencySampling(every);
+        }
+    }
+
+    void ResetStats()
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            shards_[i]->shard_.ResetStats();
+        }
+    }
+
+    // Shards returns the number of shards.
+    static constexpr std::size_t Shards()
+    {
+        return N;
+    }
+
+private:
+    // the first (capacity % N) shards take one extra slot each.
+    static int64_t shard_capacity(int64_t capacity, std::size_t i)
+    {
+        const int64_t n = static_cast<int64_t>(N);
+        return capacity / n + (static_cast<int64_t>(i) < capacity % n ? 1 : 0);
+    }
+
+    // group_by_shard counting-sorts the batch positions by shard into a
+    // per-thread scratch buffer, so batching does not allocate once warm.
+    template<typename item_t, typename F>
+    const shard_groups& group_by_shard(const item_t* items, size_t count, F key_of)
+    {
+        static thread_local shard_groups groups;
+        groups.shard_of_.resize(count);
+        groups.index_.resize(count);
+        std::fill(groups.offsets_, groups.offsets_ + N + 1, 0);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            groups.shard_of_[i] = static_cast<uint32_t>(shard_index(hasher_(key_of(items[i]))));
+            groups.offsets_[groups.shard_of_[i] + 1]++;
+        }
+        for (std::size_t s = 0; s < N; ++s)
+        {
+            groups.offsets_[s + 1] += groups.offsets_[s];
+        }
+
+        std::size_t next[N];
+        std::copy(groups.offsets_, groups.offsets_ + N, next);
+        for (size_t i = 0; i < count; ++i)
+        {
+            groups.index_[next[groups.shard_of_[i]]++] = static_cast<uint32_t>(i);
+        }
+        return groups;
+    }
+
+    // a key and its lookup types (string_view for strings) hash alike, see
+    // key_hash.
+    template<typename K>
+    shard_t& shard(const K& key)
+    {
+        return shards_[shard_index(hasher_(key))]->shard_;
+    }
+
+    // sequential keys would otherwise walk the shards in lock step.
+    static std::size_t shard_index(std::size_t hash)
+    {
+        return static_cast<std::size_t>(mix_hash(hash) % N);
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////
+void sharded_lru_test()
+{
+    int res = 0;
+    ShardedLruCache<int, int, 8> cache(100, std::chrono::seconds(60));
+    std::cout << "-------------------sharded LRU cache---------------------" << std::endl;
+    for (int i = 0; i < 50; ++i)
+    {
+        cache.Set(i, i * 10);
+    }
+    std::cout << "capacity = " << cache.Capacity() << ", length = " << cache.Length() << std::endl;
+    std::cout << cache.Get(49, res) << " - " << res << std::endl;
+    std::cout << "item 49 is exist : " << cache.IsExist(49) << std::endl;
+    std::cout << "delete 49 : " << cache.Delete(49) << std::endl;
+    std::cout << "item 49 is exist : " << cache.IsExist(49) << std::endl;
+
+    std::vector<std::pair<int, int>> items;
+    std::vector<int> keys;
+    for (int i = 100; i < 110; ++i)
+    {
+        items.push_back(std::make_pair(i, i * 10));
+        keys.push_back(i);
+    }
+    std::vector<int> values;
+    std::vector<bool> found;
+    cache.MultiSet(items);
+    std::cout << "MultiGet hits = " << cache.MultiGet(keys, values, found) << ", values[3] = " << values[3]
+              << std::endl;
+    std::cout << "MultiDelete = " << cache.MultiDelete(keys) << std::endl;
+
+    ExpirySweeper sweeper(std::chrono::milliseconds(100));
+    sweeper.Watch(cache);
+    sweeper.Start();
+    cache.SetWithTTL(1000, 1, std::chrono::seconds(0));
+    std::cout << "before sweep length = " << cache.Length();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * 1000));
+    sweeper.Stop();
+    std::cout << ", after sweep length = " << cache.Length() << std::endl;
+
+    cache.SetCapacity(16);
+    std::cout << "capacity = " << cache.Capacity() << ", length = " << cache.Length() << std::endl;
+
+    cache_stats stats = cache.Stats();
+    std::cout << "Stats : hits = " << stats.hits_ << ", misses = " << stats.misses_ << ", hit ratio = "
+              << stats.hit_ratio() << ", evictions = " << stats.evictions_ << std::endl;
+}
+
+// lru_throughput runs a 90% Get / 10% Set mix over `key_space` keys and
+// returns the aggregate throughput in Mops/s.
+template<typename cache_t>
+double lru_throughput(cache_t& cache, int threads, int ops_per_thread, int key_space)
+{
+    for (int i = 0; i < key_space; ++i)
+    {
+        cache.Set(i, i);
+    }
+
+    auto elapsed = run_threads(threads, [&cache, ops_per_thread, key_space](int) {
+        int value = 0;
+        for (int i = 0; i < ops_per_thread; ++i)
+        {
+            uint32_t r = fast_rand();
+            int key = static_cast<int>(r % key_space);
+            if ((r >> 24) % 10 == 0)
+            {
+                cache.Set(key, key);
+            }
+            else
+            {
+                cache.Get(key, value);
+            }
+        }
+    });
+    return mops(static_cast<int64_t>(threads) * ops_per_thread, elapsed);
+}
+
+// sharded_lru_bench compares the single-lock LruCache with ShardedLruCache.
+// Both get the same capacity, twice the key space so that every shard
+// holds its share of the keys, and the numbers measure lock contention
+// rather than eviction.
+void sharded_lru_bench()
+{
+    std::cout << "-------------------sharded LRU bench (Mops/s)---------------------" << std::endl;
+    const int key_space = 1 << 16;
+    const int capacity = key_space * 2;
+    const int ops = 200000;
+
+    int counts[] = {1, 4, 8, 16, 32};
+    for (int threads : counts)
+    {
+        LruCache<int, int> single(capacity);
+        ShardedLruCache<int, int, 64> sharded(capacity);
+        double a = lru_throughput(single, threads, ops, key_space);
+        double b = lru_throughput(sharded, threads, ops, key_space);
+        std::cout << "threads = " << threads << "\tLruCache = " << a << "\tShardedLruCache<64> = " << b << std::endl;
+    }
+}
+
+// lru_stats_bench prices the latency sampling on Get, off, one in 64 and
+// every call, and prints the sampled percentiles of a 4-thread run.
+void lru_stats_bench()
+{
+    std::cout << "-------------------LruCache stats (Get ns/op)---------------------" << std::endl;
+    const int keys = 1 << 16;
+    const int ops = 1000000;
+    uint32_t rates[] = {0, 64, 1};
+    for (uint32_t every : rates)
+    {
+        LruCache<int, int, slab_storage, clock_policy> cache(keys);
+        for (int i = 0; i < keys; ++i)
+        {
+            cache.Set(i, i);
+        }
+        cache.SetLatencySampling(every);
+
+        int value = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ops; ++i)
+        {
+            cache.Get(static_cast<int>(fast_rand() % (2 * keys)), value);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        cache_stats stats = cache.Stats();
+        std::cout << "sampling " << (every == 0 ? "off" : "1/" + std::to_string(every)) << "\tns/op = " << elapsed.count() / ops
+                  << "\thit ratio = " << stats.hit_ratio() << "\tsampled = " << stats.get_latency_.count()
+                  << std::endl;
+    }
+
+    ShardedLruCache<int, int, 16> sharded(keys);
+    sharded.SetLatencySampling(16);
+    lru_throughput(sharded, 4, ops / 4, keys);
+    cache_stats stats = sharded.Stats();
+    std::cout << "ShardedLruCache<16>, 4 threads : Get p50 = " << stats.get_latency_.percentile(50)
+              << ", p99 = " << stats.get_latency_.percentile(99) << ", p99.9 = " << stats.get_latency_.percentile(99.9)
+              << "; Set p50 = " << stats.set_latency_.percentile(50) << ", p99 = " << stats.set_latency_.percentile(99)
+              << std::endl;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "head.hpp"
+#include "singleton.hpp"
+
+#include <pthread.h>
+
+/// <summary>
+/// SharedMutex is a reader/writer lock on top of pthread_rwlock, preferring
+/// writers so a steady stream of readers cannot starve them. It satisfies
+/// the Lockable requirements, so std::lock_guard takes it exclusively and
+/// SharedLock takes it shared.
+/// </summary>
+class SharedMutex : public Noncopyable
+{
+private:
+    pthread_rwlock_t lock_;
+
+public:
+    SharedMutex()
+    {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&lock_, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+
+    ~SharedMutex()
+    {
+        pthread_rwlock_destroy(&lock_);
+    }
+
+    void lock()
+    {
+        pthread_rwlock_wrlock(&lock_);
+    }
+
+    void unlock()
+    {
+        pthread_rwlock_unlock(&lock_);
+    }
+
+    void lock_shared()
+    {
+        pthread_rwlock_rdlock(&lock_);
+    }
+
+    void unlock_shared()
+    {
+        pthread_rwlock_unlock(&lock_);
+    }
+};
+
+// SharedLock holds a SharedMutex in shared mode for its lifetime.
+class SharedLock : public Noncopyable
+{
+private:
+    SharedMutex& mutex_;
+
+public:
+    explicit SharedLock(SharedMutex& mutex)
+        : mutex_(mutex)
+    {
+        mutex_.lock_shared();
+    }
+
+    ~SharedLock()
+    {
+        mutex_.unlock_shared();
+    }
+};
+
+// HitLock holds a SharedMutex shared or exclusive, chosen at construction.
+// Caches use it for read paths whose mode depends on the eviction policy.
+class HitLock : public Noncopyable
+{
+private:
+    SharedMutex& mutex_;
+    const bool shared_;
+
+public:
+    HitLock(SharedMutex& mutex, bool shared)
+        : mutex_(mutex)
+        , shared_(shared)
+    {
+        if (shared_)
+            mutex_.lock_shared();
+        else
+            mutex_.lock();
+    }
+
+    ~HitLock()
+    {
+        if (shared_)
+            mutex_.unlock_shared();
+        else
+            mutex_.unlock();
+    }
+};
@@ -2,6 +2,10 @@
 
 #include "head.hpp"
 
+// shuffle is Fisher-Yates, which stays on one thread: every swap may touch
+// any slot still unshuffled, so steps cannot run side by side. A parallel
+// shuffle needs another algorithm, shuffling blocks and merging them at
+// random.
 void shuffle(std::vector<int>& src)
 {
     int size = src.size();
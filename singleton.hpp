@@ -1,5 +1,8 @@
 #pragma once
 
+#include "head.hpp"
+#include "bench.hpp"
+
 class Noncopyable
 {
 protected:
@@ -12,30 +15,265 @@ protected:
     Noncopyable& operator=(Noncopyable&&) = delete;
 };
 
+/// <summary>
+/// SingleTon holds one T per process, made on the first Instance call.
+/// Once made, Instance is one acquire load; only the first calls take the
+/// mutex (double-checked locking on an atomic pointer). Release deletes
+/// the instance and resets the pointer, so the next Instance makes a new
+/// one; no other thread may be using the old one then.
+/// </summary>
 template<typename T>
 class SingleTon : public Noncopyable
 {
 private:
-    static T* instance_;
-    static std::once_flag once_;
+    static std::atomic<T*> instance_;
+    static std::mutex mutex_;
 
-    static void init()
+    static T* create()
     {
-        if (instance_ == nullptr)
+        std::lock_guard<std::mutex> lock(mutex_);
+        T* instance = instance_.load(std::memory_order_relaxed);
+        if (instance == nullptr)
         {
-            instance_ = new T();
+            instance = new T();
+            instance_.store(instance, std::memory_order_release);
         }
+        return instance;
     }
 
 public:
     static T* Instance()
     {
-        std::call_once(once_, &SingleTon<T>::init);
-        return instance_;
+        T* instance = instance_.load(std::memory_order_acquire);
+        if (instance != nullptr)
+            return instance;
+        return create();
     }
 
     static void Release()
     {
-        delete instance_;
+        std::lock_guard<std::mutex> lock(mutex_);
+        delete instance_.exchange(nullptr, std::memory_order_acq_rel);
+    }
+};
+
+template<typename T>
+std::atomic<T*> SingleTon<T>::instance_{nullptr};
+
+template<typename T>
+std::mutex SingleTon<T>::mutex_;
+
+/// <summary>
+/// ThreadLocalSingleton holds one T per thread, for per-thread state such
+/// as counters, scratch buffers and generators that would otherwise be a
+/// shared singleton every thread writes to. Instance is a thread_local
+/// pointer load once the thread's T exists. Every T is kept in a registry,
+/// each on its own cache lines, so ForEach can sum them up; the T of a
+/// thread that has exited stays there, its totals still counted, until
+/// ReleaseExited. ForEach reads a T while its thread may write it, so the
+/// fields it reads must be atomics.
+/// </summary>
+template<typename T>
+class ThreadLocalSingleton : public Noncopyable
+{
+private:
+    struct alignas(64) slot
+    {
+        T value_;
+        bool exited_{false};
+    };
+
+    struct registry
+    {
+        std::mutex mutex_;
+        std::vector<std::unique_ptr<slot>> slots_;
+    };
+
+    // thread_slot marks the thread's slot exited when the thread exits.
+    struct thread_slot
+    {
+        slot* slot_{nullptr};
+
+        ~thread_slot()
+        {
+            registry& reg = get_registry();
+            std::lock_guard<std::mutex> lock(reg.mutex_);
+            slot_->exited_ = true;
+            cached() = nullptr;
+        }
+    };
+
+    // cached is trivially destructible, so reading it needs no thread_local
+    // guard, unlike thread_slot.
+    static T*& cached()
+    {
+        static thread_local T* value = nullptr;
+        return value;
+    }
+
+    // the registry is never destroyed, threads may exit after main returns
+    static registry& get_registry()
+    {
+        static registry* reg = new registry();
+        return *reg;
+    }
+
+    static T* create()
+    {
+        static thread_local thread_slot ts;
+        registry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex_);
+        reg.slots_.emplace_back(new slot());
+        ts.slot_ = reg.slots_.back().get();
+        cached() = &ts.slot_->value_;
+        return cached();
+    }
+
+public:
+    static T& Instance()
+    {
+        T* instance = cached();
+        if (instance == nullptr)
+            instance = create();
+        return *instance;
+    }
+
+    // ForEach calls f(T&) for every thread's T, live or exited, under the
+    // registry lock.
+    template<typename F>
+    static void ForEach(F f)
+    {
+        registry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex_);
+        for (auto& s : reg.slots_)
+            f(s->value_);
+    }
+
+    // ReleaseExited deletes the T of every thread that has exited.
+    static void ReleaseExited()
+    {
+        registry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex_);
+        auto& slots = reg.slots_;
+        slots.erase(std::remove_if(slots.begin(), slots.end(), [](const std::unique_ptr<slot>& s) { return s->exited_; }),
+            slots.end());
+    }
+};
+
+// singleton_counter is per-thread state for ThreadLocalSingleton: written
+// by its thread only, read by ForEach from others.
+struct singleton_counter
+{
+    std::atomic<uint64_t> count_{0};
+    int id_{0};
+
+    singleton_counter()
+    {
+        static std::atomic<int> made{0};
+        id_ = ++made;
+    }
+
+    void add(uint64_t n = 1)
+    {
+        count_.store(count_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+void singleton_test()
+{
+    std::cout << "-----------------singleton_test-------------------" << std::endl;
+
+    singleton_counter* first = SingleTon<singleton_counter>::Instance();
+    const bool same = first == SingleTon<singleton_counter>::Instance();
+    const int first_id = first->id_;
+    SingleTon<singleton_counter>::Release();
+    const bool remade = SingleTon<singleton_counter>::Instance()->id_ != first_id;
+    SingleTon<singleton_counter>::Release();
+    std::cout << "SingleTon same instance : " << same << ", made again after Release : " << remade << std::endl;
+
+    using local_counter = ThreadLocalSingleton<singleton_counter>;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([]() {
+            for (int i = 0; i < 100000; ++i)
+                local_counter::Instance().add();
+        });
     }
+    for (auto& th : threads)
+        th.join();
+    local_counter::Instance().add(7);
+
+    uint64_t total = 0;
+    int instances = 0;
+    local_counter::ForEach([&](singleton_counter& c) {
+        total += c.count_.load(std::memory_order_relaxed);
+        instances++;
+    });
+    local_counter::ReleaseExited();
+    int kept = 0;
+    local_counter::ForEach([&](singleton_counter&) { kept++; });
+    std::cout << "ThreadLocalSingleton total = " << total << " (expect 400007) over " << instances
+              << " instances, " << kept << " kept after ReleaseExited" << std::endl;
+}
+
+// once_instance is the call_once lookup SingleTon used to do on every call.
+template<typename T>
+T* once_instance()
+{
+    static T* instance = nullptr;
+    static std::once_flag once;
+    std::call_once(once, []() { instance = new T(); });
+    return instance;
+}
+
+struct singleton_bench_counter : singleton_counter
+{
 };
+
+// singleton_bench times Instance lookups from 1 and 4 threads, then counts
+// events from 4 threads into one shared atomic against one
+// ThreadLocalSingleton counter per thread.
+void singleton_bench()
+{
+    std::cout << "-------------------singleton: ns per Instance call---------------------" << std::endl;
+    const int calls = 10000000;
+    for (int threads : {1, 4})
+    {
+        auto time = [threads, calls](auto lookup) {
+            std::atomic<uintptr_t> sink{0};
+            auto elapsed = run_threads(threads, [&](int) {
+                uintptr_t sum = 0;
+                for (int i = 0; i < calls; ++i)
+                    sum += reinterpret_cast<uintptr_t>(lookup());
+                sink += sum;
+            });
+            return static_cast<double>(elapsed.count()) / calls;
+        };
+        std::cout << "threads = " << threads
+                  << "\tcall_once = " << time([]() { return once_instance<singleton_bench_counter>(); })
+                  << "\tSingleTon = " << time([]() { return SingleTon<singleton_bench_counter>::Instance(); })
+                  << "\tThreadLocalSingleton = "
+                  << time([]() { return &ThreadLocalSingleton<singleton_bench_counter>::Instance(); }) << std::endl;
+    }
+
+    std::cout << "-------------------singleton: shared vs thread-local counter, 4 threads---------------------"
+              << std::endl;
+    const int threads = 4;
+    SingleTon<singleton_bench_counter>::Instance()->count_.store(0);
+    auto shared = run_threads(threads, [calls](int) {
+        singleton_bench_counter* counter = SingleTon<singleton_bench_counter>::Instance();
+        for (int i = 0; i < calls; ++i)
+            counter->count_.fetch_add(1, std::memory_order_relaxed);
+    });
+    auto local = run_threads(threads, [calls](int) {
+        for (int i = 0; i < calls; ++i)
+            ThreadLocalSingleton<singleton_bench_counter>::Instance().add();
+    });
+    uint64_t total = 0;
+    ThreadLocalSingleton<singleton_bench_counter>::ForEach(
+        [&total](singleton_bench_counter& c) { total += c.count_.load(std::memory_order_relaxed); });
+    std::cout << "shared atomic = " << mops(int64_t(threads) * calls, shared)
+              << " Mops/s\tthread-local = " << mops(int64_t(threads) * calls, local) << " Mops/s (total " << total
+              << ")" << std::endl;
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+#include "head.hpp"
+#include "singleton.hpp"
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Cache snapshots for warm restarts. A snapshot file is a 64-byte header
+// followed by one record per entry, oldest first, so replaying the records
+// in file order rebuilds the recency order:
+//
+//   key, value, ttl (seconds, -1 = none), remaining (milliseconds until
+//   the TTL ran out at save time, meaningless without a TTL)
+//
+// Keys and values go through snapshot_codec. When both are trivially
+// copyable a record is the fixed-size snapshot_record struct and the loader
+// reads the records in place from the mapped file.
+
+// snapshot_codec writes and reads one key or value. The generic codec
+// copies the bytes of trivially copyable types; other types need a
+// specialization like the std::string one.
+template<typename T, typename = void>
+struct snapshot_codec
+{
+    static_assert(std::is_trivially_copyable<T>::value, "specialize snapshot_codec for this type");
+
+    static const bool fixed = true;
+
+    static void write(std::string& out, const T& item)
+    {
+        out.append(reinterpret_cast<const char*>(&item), sizeof(T));
+    }
+
+    // read decodes an item at pos, or returns false if the data ends first.
+    static bool read(const char*& pos, const char* end, T& item)
+    {
+        if (static_cast<std::size_t>(end - pos) < sizeof(T))
+            return false;
+
+        std::memcpy(&item, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+};
+
+template<>
+struct snapshot_codec<std::string>
+{
+    static const bool fixed = false;
+
+    static void write(std::string& out, const std::string& item)
+    {
+        uint32_t size = static_cast<uint32_t>(item.size());
+        out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.append(item);
+    }
+
+    static bool read(const char*& pos, const char* end, std::string& item)
+    {
+        uint32_t size = 0;
+        if (static_cast<std::size_t>(end - pos) < sizeof(size))
+            return false;
+
+        std::memcpy(&size, pos, sizeof(size));
+        if (static_cast<std::size_t>(end - pos) - sizeof(size) < size)
+            return false;
+
+        item.assign(pos + sizeof(size), size);
+        pos += sizeof(size) + size;
+        return true;
+    }
+};
+
+template<typename T, typename U>
+const bool snapshot_codec<T, U>::fixed;
+
+struct snapshot_header
+{
+    char magic_[8];
+    uint32_t version_;
+    uint32_t fixed_;       // 1 if the records are snapshot_record structs
+    uint32_t key_size_;    // sizeof(key_t) and sizeof(value_t), a cheap
+    uint32_t value_size_;  // check that the file was saved by the same types
+    uint64_t count_;
+    int64_t saved_at_;     // milliseconds since the epoch
+    char padding_[24];
+};
+
+static_assert(sizeof(snapshot_header) == 64, "snapshot_header must stay 64 bytes");
+
+// snapshot_record is the record layout when key and value are both fixed.
+template<typename key_t, typename value_t>
+struct snapshot_record
+{
+    key_t key_;
+    value_t value_;
+    int64_t ttl_;
+    int64_t remaining_;
+};
+
+// snapshot_writer writes a snapshot to `path` through a temporary file that
+// is synced and renamed over it once complete, so a crash or a failed write
+// mid-save leaves the previous snapshot in place.
+template<typename key_t, typename value_t>
+class snapshot_writer : public Noncopyable
+{
+private:
+    using key_codec = snapshot_codec<key_t>;
+    using value_codec = snapshot_codec<value_t>;
+
+    std::string path_;
+    std::string tmp_path_;
+    std::FILE* file_{nullptr};
+    std::string buffer_;
+    uint64_t count_{0};
+    int64_t saved_at_;
+    bool failed_{false}; // a write has failed, commit will not rename
+
+public:
+    snapshot_writer(const std::string& path, int64_t saved_at)
+        : path_(path)
+        , tmp_path_(path + ".tmp")
+        , saved_at_(saved_at)
+    {
+        file_ = std::fopen(tmp_path_.c_str(), "wb");
+        if (file_ != nullptr)
+        {
+            snapshot_header header = make_header();
+            failed_ = std::fwrite(&header, sizeof(header), 1, file_) != 1;
+        }
+    }
+
+    ~snapshot_writer()
+    {
+        if (file_ != nullptr)
+        {
+            std::fclose(file_);
+            std::remove(tmp_path_.c_str());
+        }
+    }
+
+    bool ok() const
+    {
+        return file_ != nullptr && !failed_;
+    }
+
+    void add(const key_t& key, const value_t& value, int64_t ttl, int64_t remaining)
+    {
+        if constexpr (key_codec::fixed && value_codec::fixed)
+        {
+            snapshot_record<key_t, value_t> record;
+            std::memset(&record, 0, sizeof(record)); // no stray bytes in the padding
+            record.key_ = key;
+            record.value_ = value;
+            record.ttl_ = ttl;
+            record.remaining_ = remaining;
+            buffer_.append(reinterpret_cast<const char*>(&record), sizeof(record));
+        }
+        else
+        {
+            key_codec::write(buffer_, key);
+            value_codec::write(buffer_, value);
+            buffer_.append(reinterpret_cast<const char*>(&ttl), sizeof(ttl));
+            buffer_.append(reinterpret_cast<const char*>(&remaining), sizeof(remaining));
+        }
+        count_++;
+
+        if (buffer_.size() >= (1 << 20))
+            flush();
+    }
+
+    // commit completes the file, syncs it to disk and moves it over `path`,
+    // then syncs the directory so the rename survives a crash too. It
+    // returns false, leaving `path` as it was, if any write or sync failed.
+    bool commit()
+    {
+        if (file_ == nullptr)
+            return false;
+
+        bool ok = !failed_ && flush();
+        snapshot_header header = make_header();
+        ok = ok && std::fseek(file_, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file_) == 1;
+        ok = ok && std::fflush(file_) == 0 && std::ferror(file_) == 0 && ::fsync(::fileno(file_)) == 0;
+        ok = std::fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        ok = ok && std::rename(tmp_path_.c_str(), path_.c_str()) == 0;
+        if (!ok)
+        {
+            std::remove(tmp_path_.c_str());
+            return false;
+        }
+        return sync_directory();
+    }
+
+private:
+    snapshot_header make_header() const
+    {
+        snapshot_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic_, "LRUSNAP", 8);
+        header.version_ = 1;
+        header.fixed_ = key_codec::fixed && value_codec::fixed ? 1 : 0;
+        header.key_size_ = sizeof(key_t);
+        header.value_size_ = sizeof(value_t);
+        header.count_ = count_;
+        header.saved_at_ = saved_at_;
+        return header;
+    }
+
+    // flush writes the buffered records, returning false on a short write.
+    bool flush()
+    {
+        if (!buffer_.empty() && std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size())
+            failed_ = true;
+        buffer_.clear();
+        return !failed_;
+    }
+
+    // sync_directory makes the rename of the temporary file durable.
+    bool sync_directory() const
+    {
+        const std::size_t slash = path_.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path_.substr(0, slash);
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+            return false;
+
+        bool ok = ::fsync(fd) == 0;
+        ok = ::close(fd) == 0 && ok;
+        return ok;
+    }
+};
+
+// read_snapshot maps the snapshot at `path` and calls
+// visit(key, value, ttl, remaining) for its records in file order, with
+// `remaining` already reduced by the time since the save. It returns the
+// number of records read, or -1 if the file is missing, was saved for other
+// types or is truncated (the records before the cut have been visited).
+template<typename key_t, typename value_t, typename F>
+int64_t read_snapshot(const std::string& path, int64_t now, F visit)
+{
+    using key_codec = snapshot_codec<key_t>;
+    using value_codec = snapshot_codec<value_t>;
+    using record_t = snapshot_record<key_t, value_t>;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(snapshot_header))
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    const std::size_t length = static_cast<std::size_t>(st.st_size);
+    void* map = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    ::madvise(map, length, MADV_SEQUENTIAL);
+
+    const char* begin = static_cast<const char*>(map);
+    const char* end = begin + length;
+    snapshot_header header;
+    std::memcpy(&header, begin, sizeof(header));
+
+    constexpr bool fixed = key_codec::fixed && value_codec::fixed;
+    int64_t count = -1;
+    if (std::memcmp(header.magic_, "LRUSNAP", 8) == 0 && header.version_ == 1 &&
+        header.fixed_ == (fixed ? 1U : 0U) && header.key_size_ == sizeof(key_t) &&
+        header.value_size_ == sizeof(value_t))
+    {
+        const int64_t elapsed = std::max<int64_t>(0, now - header.saved_at_);
+        auto age = [elapsed](int64_t remaining) { return remaining - elapsed; };
+
+        if constexpr (fixed)
+        {
+            // the header keeps the records aligned, read them in place
+            const record_t* records = reinterpret_cast<const record_t*>(begin + sizeof(header));
+            if ((length - sizeof(header)) / sizeof(record_t) >= header.count_)
+            {
+                for (uint64_t i = 0; i < header.count_; ++i)
+                {
+                    visit(records[i].key_, records[i].value_, records[i].ttl_, age(records[i].remaining_));
+                }
+                count = static_cast<int64_t>(header.count_);
+            }
+        }
+        else
+        {
+            const char* pos = begin + sizeof(header);
+            key_t key;
+            value_t value;
+            int64_t times[2];
+            uint64_t i = 0;
+            for (; i < header.count_; ++i)
+            {
+                if (!key_codec::read(pos, end, key) || !value_codec::read(pos, end, value) ||
+                    static_cast<std::size_t>(end - pos) < sizeof(times))
+                    break;
+
+                std::memcpy(times, pos, sizeof(times));
+                pos += sizeof(times);
+                visit(key, value, times[0], age(times[1]));
+            }
+            count = i == header.count_ ? static_cast<int64_t>(i) : -1;
+        }
+    }
+
+    ::munmap(map, length);
+    return count;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "head.hpp"
+#include "thread_pool.hpp"
 
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
@@ -45,102 +46,294 @@ void select_sort(std::vector<int>& src)
 
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
-void quick_sort_i(std::vector<int>& src, int l, int r)
+// The sort engine: introsort over random access iterators with a strict
+// weak ordering comp. Quicksort with a median-of-3 pivot, the ninther
+// (median of three medians of 3) on big ranges, recursing into the
+// smaller side and looping on the bigger so the stack stays O(log n),
+// insertion sort below insertion_cutoff elements and heapsort once the
+// recursion is 2 log2(n) deep, so the worst case is O(n log n).
+
+const std::ptrdiff_t insertion_cutoff = 16;
+const std::ptrdiff_t ninther_cutoff = 128;
+
+template<typename Iter, typename Compare>
+void insertion_sort(Iter first, Iter last, Compare comp)
 {
-    if (l > r)
+    if (first == last)
     {
         return;
     }
 
-    int left = l;
-    int right = r;
-    int base_value = src[l];
+    for (Iter i = first + 1; i != last; ++i)
+    {
+        auto value = std::move(*i);
+        if (comp(value, *first))
+        {
+            std::move_backward(first, i, i + 1);
+            *first = std::move(value);
+            continue;
+        }
+
+        // *first is not bigger than value, so the scan stops without a bound
+        Iter j = i;
+        for (; comp(value, *(j - 1)); --j)
+        {
+            *j = std::move(*(j - 1));
+        }
+        *j = std::move(value);
+    }
+}
 
-    while (left < right)
+template<typename Iter, typename Compare>
+void sift_down(Iter first, std::ptrdiff_t i, std::ptrdiff_t n, Compare comp)
+{
+    auto value = std::move(first[i]);
+    while (true)
     {
-        while (left < right && src[right] >= base_value)
+        std::ptrdiff_t child = 2 * i + 1;
+        if (child >= n)
         {
-            right--;
+            break;
         }
 
-        while (left < right && src[left] <= base_value)
+        if (child + 1 < n && comp(first[child], first[child + 1]))
         {
-            left++;
+            child++;
         }
 
-        if (left < right)
+        if (!comp(value, first[child]))
         {
-            swap(src, left, right);
+            break;
         }
+
+        first[i] = std::move(first[child]);
+        i = child;
     }
+    first[i] = std::move(value);
+}
 
-    src[l] = src[left];
-    src[left] = base_value;
+template<typename Iter, typename Compare>
+void heap_sort(Iter first, Iter last, Compare comp)
+{
+    const std::ptrdiff_t n = last - first;
+    for (std::ptrdiff_t i = n / 2 - 1; i >= 0; --i)
+    {
+        sift_down(first, i, n, comp);
+    }
 
-    quick_sort_i(src, l, left - 1);
-    quick_sort_i(src, left + 1, r);
+    for (std::ptrdiff_t end = n - 1; end > 0; --end)
+    {
+        std::iter_swap(first, first + end);
+        sift_down(first, 0, end, comp);
+    }
 }
 
-void quick_sort(std::vector<int>& src)
+// sort3 orders *a, *b, *c, leaving the median in *b.
+template<typename Iter, typename Compare>
+void sort3(Iter a, Iter b, Iter c, Compare comp)
 {
-    quick_sort_i(src, 0, src.size() - 1);
+    if (comp(*b, *a))
+    {
+        std::iter_swap(a, b);
+    }
+
+    if (comp(*c, *b))
+    {
+        std::iter_swap(b, c);
+        if (comp(*b, *a))
+        {
+            std::iter_swap(a, b);
+        }
+    }
 }
 
-////////////////////////////////////////////////
-////////////////////////////////////////////////
-void sink(std::vector<int>& src, int k, int N)
+// intro_partition picks the pivot, moves it to its sorted place and
+// returns that place: the elements before are not bigger, the ones after
+// not smaller. Elements equal to the pivot stop both scans, so runs of
+// equal keys split down the middle instead of going quadratic.
+template<typename Iter, typename Compare>
+Iter intro_partition(Iter first, Iter last, Compare comp)
 {
+    const std::ptrdiff_t n = last - first;
+    Iter mid = first + n / 2;
+    if (n > ninther_cutoff)
+    {
+        const std::ptrdiff_t s = n / 8;
+        sort3(first, first + s, first + 2 * s, comp);
+        sort3(mid - s, mid, mid + s, comp);
+        sort3(last - 1 - 2 * s, last - 1 - s, last - 1, comp);
+        sort3(first + s, mid, last - 1 - s, comp);
+    }
+    else
+    {
+        sort3(first, mid, last - 1, comp);
+    }
+    std::iter_swap(first, mid);
+
+    Iter i = first;
+    Iter j = last;
     while (true)
     {
-        int i = k * 2;
+        do
+        {
+            ++i;
+        } while (i != last && comp(*i, *first));
+
+        // *first stops the scan: it is not smaller than itself
+        do
+        {
+            --j;
+        } while (comp(*first, *j));
 
-        if (i > N)
+        if (i >= j)
         {
             break;
         }
 
-        if (i < N && src[i + 1] > src[i])
+        std::iter_swap(i, j);
+    }
+    std::iter_swap(first, j);
+    return j;
+}
+
+template<typename Iter, typename Compare>
+void intro_sort_i(Iter first, Iter last, int depth, Compare comp)
+{
+    while (last - first > insertion_cutoff)
+    {
+        if (depth == 0)
         {
-            i++;
+            heap_sort(first, last, comp);
+            return;
         }
+        depth--;
 
-        if (src[i] > src[k])
+        Iter pivot = intro_partition(first, last, comp);
+        if (pivot - first < last - pivot)
         {
-            swap(src, k, i);
+            intro_sort_i(first, pivot, depth, comp);
+            first = pivot + 1;
+        }
+        else
+        {
+            intro_sort_i(pivot + 1, last, depth, comp);
+            last = pivot;
         }
-
-        k = i;
     }
+    insertion_sort(first, last, comp);
+}
+
+// intro_depth is the recursion depth after which introsort turns to
+// heapsort: 2 log2(n).
+inline int intro_depth(std::ptrdiff_t n)
+{
+    return n < 2 ? 0 : 2 * (63 - __builtin_clzll(static_cast<uint64_t>(n)));
+}
+
+template<typename Iter, typename Compare>
+void intro_sort(Iter first, Iter last, Compare comp)
+{
+    intro_sort_i(first, last, intro_depth(last - first), comp);
+}
+
+template<typename Iter>
+void intro_sort(Iter first, Iter last)
+{
+    intro_sort(first, last, std::less<>());
+}
+
+void quick_sort(std::vector<int>& src)
+{
+    intro_sort(src.begin(), src.end());
 }
 
 void heap_sort(std::vector<int>& src)
 {
-    int N = src.size();
+    heap_sort(src.begin(), src.end(), std::less<int>());
+}
 
-    if (N == 0)
+// parallel_intro_sort_i sorts [first, last) like intro_sort_i, handing the
+// left part of every partition bigger than `cutoff` to the pool.
+template<typename Iter, typename Compare>
+void parallel_intro_sort_i(
+    ThreadPool& pool, WaitGroup& wg, Iter first, Iter last, int depth, std::ptrdiff_t cutoff, Compare comp)
+{
+    while (last - first > cutoff)
     {
-        return;
+        if (depth == 0)
+        {
+            heap_sort(first, last, comp);
+            return;
+        }
+        depth--;
+
+        Iter pivot = intro_partition(first, last, comp);
+        pool.Submit(wg, [&pool, &wg, first, pivot, depth, cutoff, comp]() {
+            parallel_intro_sort_i(pool, wg, first, pivot, depth, cutoff, comp);
+        });
+        first = pivot + 1;
     }
+    intro_sort_i(first, last, depth, comp);
+}
 
-    src.insert(src.begin(), 0);
+template<typename Iter, typename Compare>
+void parallel_intro_sort(ThreadPool& pool, Iter first, Iter last, Compare comp, std::ptrdiff_t cutoff = 4096)
+{
+    WaitGroup wg;
+    parallel_intro_sort_i(pool, wg, first, last, intro_depth(last - first), std::max<std::ptrdiff_t>(cutoff, 1), comp);
+    pool.Wait(wg);
+}
 
-    for (int k = N / 2; k > 0; --k)
+void parallel_quick_sort(ThreadPool& pool, std::vector<int>& src, int cutoff = 4096)
+{
+    parallel_intro_sort(pool, src.begin(), src.end(), std::less<int>(), cutoff);
+}
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+const char* const sort_input_kinds[] = {
+    "random", "sorted", "reversed", "equal", "few_unique", "organ_pipe", "sawtooth", "median3_killer"};
+
+// sort_input makes n ints of one of sort_input_kinds: the patterns that
+// break naive quicksorts. median3_killer is Musser's sequence against a
+// first/middle/last median of 3.
+std::vector<int> sort_input(const std::string& kind, int n)
+{
+    std::vector<int> src(n);
+    for (int i = 0; i < n; ++i)
     {
-        sink(src, k, N);
+        if (kind == "random")
+            src[i] = static_cast<int>(fast_rand());
+        else if (kind == "sorted")
+            src[i] = i;
+        else if (kind == "reversed")
+            src[i] = n - i;
+        else if (kind == "equal")
+            src[i] = 7;
+        else if (kind == "few_unique")
+            src[i] = static_cast<int>(fast_rand() % 16);
+        else if (kind == "organ_pipe")
+            src[i] = i < n / 2 ? i : n - i;
+        else if (kind == "sawtooth")
+            src[i] = i % 1024;
     }
 
-    while (N > 1)
+    if (kind == "median3_killer")
     {
-        swap(src, 1, N);
-        N--;
-        sink(src, 1, N);
+        const int k = n / 2;
+        for (int i = 1; i <= k; ++i)
+        {
+            if (i % 2 == 1)
+            {
+                src[i - 1] = i;
+                src[i] = k + i;
+            }
+            src[k + i - 1] = 2 * i;
+        }
     }
-
-    src.erase(src.begin());
+    return src;
 }
 
-////////////////////////////////////////////////
-////////////////////////////////////////////////
 void sort_test()
 {
     std::vector<int> bubble_src;
@@ -151,6 +344,7 @@ void sort_test()
     std::vector<int> select_src = bubble_src;
     std::vector<int> quick_src = bubble_src;
     std::vector<int> heap_src = bubble_src;
+    std::vector<int> parallel_src = bubble_src;
 
     // sort about
     std::cout << "-------------------sort---------------------" << std::endl;
@@ -172,4 +366,95 @@ void sort_test()
     heap_sort(heap_src);
     std::cout << "heap_sort :     ";
     show(heap_src);
+
+    ThreadPool pool(4);
+    parallel_quick_sort(pool, parallel_src, 4);
+    std::cout << "parallel_quick_sort : ";
+    show(parallel_src);
+
+    std::vector<int> big(1000000);
+    for (auto& v : big)
+    {
+        v = static_cast<int>(fast_rand() % 1000000);
+    }
+    parallel_quick_sort(pool, big);
+    std::cout << "parallel_quick_sort 1M sorted : " << std::is_sorted(big.begin(), big.end()) << std::endl;
+
+    std::vector<std::string> words = {"pear", "apple", "fig", "kiwi", "banana"};
+    intro_sort(words.begin(), words.end(), std::greater<std::string>());
+    std::cout << "intro_sort strings, descending : ";
+    for (const auto& w : words)
+    {
+        std::cout << w << " ";
+    }
+    std::cout << std::endl;
+
+    std::cout << "quick_sort 1M adversarial inputs sorted :";
+    for (const char* kind : sort_input_kinds)
+    {
+        std::vector<int> src = sort_input(kind, 1000000);
+        quick_sort(src);
+        std::cout << " " << kind << "=" << std::is_sorted(src.begin(), src.end());
+    }
+    std::cout << std::endl;
+}
+
+// sort_bench sorts 1M and 10M ints of every input kind with std::sort,
+// intro_sort and heap_sort.
+void sort_bench()
+{
+    std::cout << "-------------------intro_sort vs std::sort (ms)---------------------" << std::endl;
+    for (int n : {1000000, 10000000})
+    {
+        for (const char* kind : sort_input_kinds)
+        {
+            const std::vector<int> origin = sort_input(kind, n);
+            auto time = [&origin](auto sort) {
+                std::vector<int> src = origin;
+                auto start = std::chrono::steady_clock::now();
+                sort(src);
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                if (!std::is_sorted(src.begin(), src.end()))
+                {
+                    std::cout << "(unsorted!) ";
+                }
+                return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1000.0;
+            };
+            std::cout << "n = " << n << "\t" << kind << "\tstd::sort = "
+                      << time([](std::vector<int>& v) { std::sort(v.begin(), v.end()); })
+                      << "\tintro_sort = " << time([](std::vector<int>& v) { quick_sort(v); })
+                      << "\theap_sort = " << time([](std::vector<int>& v) { heap_sort(v); }) << std::endl;
+        }
+    }
+}
+
+// parallel_sort_bench sorts 10M random ints with quick_sort and with
+// parallel_quick_sort on pools of 1 to 2x the CPUs.
+void parallel_sort_bench()
+{
+    std::cout << "-------------------parallel_quick_sort scaling (10M ints)---------------------" << std::endl;
+    std::vector<int> origin(10000000);
+    for (auto& v : origin)
+    {
+        v = static_cast<int>(fast_rand());
+    }
+
+    std::vector<int> src = origin;
+    auto start = std::chrono::steady_clock::now();
+    quick_sort(src);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "quick_sort = " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms";
+
+    const int cpus = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int threads = 1; threads <= 2 * cpus; threads *= 2)
+    {
+        ThreadPool pool(threads);
+        src = origin;
+        start = std::chrono::steady_clock::now();
+        parallel_quick_sort(pool, src);
+        elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "\t" << threads << "t = " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+                  << "ms";
+    }
+    std::cout << std::endl;
 }
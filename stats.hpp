@@ -0,0 +1,292 @@
+#pragma once
+
+#include "head.hpp"
+#include "singleton.hpp"
+
+// Cache statistics. Counters are striped: every thread adds to one of a few
+// cache-line sized stripes picked by its id, so concurrent readers of a
+// cache do not fight over one counter line, and a snapshot sums the stripes.
+// Latency histograms are optional and sampled.
+
+/// <summary>
+/// latency_histogram counts durations in log-linear buckets: four buckets
+/// per power of two nanoseconds, so a percentile is within 25% of the true
+/// value. Recording is a relaxed increment.
+/// </summary>
+class latency_histogram
+{
+public:
+    static const int buckets = 4 * 64;
+
+private:
+    std::atomic<uint64_t> counts_[buckets];
+
+public:
+    latency_histogram()
+    {
+        for (auto& count : counts_)
+            count.store(0, std::memory_order_relaxed);
+    }
+
+    static int bucket_of(uint64_t ns)
+    {
+        if (ns < 4)
+            return static_cast<int>(ns);
+
+        const int log = 63 - __builtin_clzll(ns);
+        return 4 * (log - 1) + static_cast<int>((ns >> (log - 2)) & 3);
+    }
+
+    // lower_bound returns the smallest duration of a bucket.
+    static uint64_t lower_bound(int bucket)
+    {
+        if (bucket < 4)
+            return static_cast<uint64_t>(bucket);
+
+        const int log = bucket / 4 + 1;
+        return (uint64_t(4) | (bucket & 3)) << (log - 2);
+    }
+
+    void record(std::chrono::nanoseconds elapsed)
+    {
+        const uint64_t ns = elapsed.count() > 0 ? static_cast<uint64_t>(elapsed.count()) : 0;
+        counts_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_to(std::vector<uint64_t>& counts) const
+    {
+        counts.resize(buckets);
+        for (int i = 0; i < buckets; ++i)
+            counts[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto& count : counts_)
+            count.store(0, std::memory_order_relaxed);
+    }
+};
+
+const int latency_histogram::buckets;
+
+// latency_stats is a histogram snapshot.
+struct latency_stats
+{
+    std::vector<uint64_t> counts_; // latency_histogram buckets, empty if not sampled
+
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (uint64_t c : counts_)
+            total += c;
+        return total;
+    }
+
+    // percentile returns the lower bound of the bucket holding the p-th
+    // percentile (0..100) of the samples, in nanoseconds.
+    uint64_t percentile(double p) const
+    {
+        const uint64_t total = count();
+        if (total == 0)
+            return 0;
+
+        const uint64_t rank = static_cast<uint64_t>(p / 100.0 * (total - 1));
+        uint64_t seen = 0;
+        for (int i = 0; i < static_cast<int>(counts_.size()); ++i)
+        {
+            seen += counts_[i];
+            if (seen > rank)
+                return latency_histogram::lower_bound(i);
+        }
+        return 0;
+    }
+
+    latency_stats& operator+=(const latency_stats& other)
+    {
+        if (counts_.size() < other.counts_.size())
+            counts_.resize(other.counts_.size());
+        for (std::size_t i = 0; i < other.counts_.size(); ++i)
+            counts_[i] += other.counts_[i];
+        return *this;
+    }
+};
+
+// cache_stats is a snapshot of a cache's counters. Misses include the
+// lookups that found an expired entry, counted again in expired_.
+struct cache_stats
+{
+    uint64_t hits_{0};
+    uint64_t misses_{0};
+    uint64_t expired_{0};
+    uint64_t evictions_{0};
+    uint64_t inserts_{0};
+    uint64_t replacements_{0};
+    uint64_t refresh_failures_{0}; // GetOrLoad refresh-ahead reloads that threw
+    latency_stats get_latency_;
+    latency_stats set_latency_;
+
+    double hit_ratio() const
+    {
+        return hits_ + misses_ == 0 ? 0 : static_cast<double>(hits_) / (hits_ + misses_);
+    }
+
+    cache_stats& operator+=(const cache_stats& other)
+    {
+        hits_ += other.hits_;
+        misses_ += other.misses_;
+        expired_ += other.expired_;
+        evictions_ += other.evictions_;
+        inserts_ += other.inserts_;
+        replacements_ += other.replacements_;
+        refresh_failures_ += other.refresh_failures_;
+        get_latency_ += other.get_latency_;
+        set_latency_ += other.set_latency_;
+        return *this;
+    }
+};
+
+/// <summary>
+/// cache_counters holds a cache's striped counters and, once sampling is
+/// turned on, its Get and Set latency histograms.
+/// </summary>
+class cache_counters : public Noncopyable
+{
+public:
+    enum counter
+    {
+        hits,
+        misses,
+        expired,
+        evictions,
+        inserts,
+        replacements,
+        refresh_failures,
+        counters
+    };
+
+    static const int stripes = 16;
+
+private:
+    struct alignas(64) stripe
+    {
+        std::atomic<uint64_t> counts_[counters];
+    };
+
+    stripe stripes_[stripes];
+    std::atomic<uint32_t> sample_every_{0};
+    std::atomic<latency_histogram*> get_latency_{nullptr};
+    std::atomic<latency_histogram*> set_latency_{nullptr};
+    std::mutex sampling_mutex_;
+
+public:
+    cache_counters()
+    {
+        reset();
+    }
+
+    ~cache_counters()
+    {
+        delete get_latency_.load();
+        delete set_latency_.load();
+    }
+
+    void add(counter c, uint64_t n = 1)
+    {
+        stripes_[stripe_index()].counts_[c].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // set_sampling times one Get or Set in `every`, 0 turns sampling off.
+    void set_sampling(uint32_t every)
+    {
+        std::lock_guard<std::mutex> lock(sampling_mutex_);
+        if (every != 0 && get_latency_.load() == nullptr)
+        {
+            get_latency_.store(new latency_histogram(), std::memory_order_release);
+            set_latency_.store(new latency_histogram(), std::memory_order_release);
+        }
+        sample_every_.store(every, std::memory_order_relaxed);
+    }
+
+    // sample returns the histogram to time this operation into, or nullptr.
+    latency_histogram* sample(bool get)
+    {
+        const uint32_t every = sample_every_.load(std::memory_order_relaxed);
+        if (every == 0)
+            return nullptr;
+
+        static thread_local uint32_t operations = 0;
+        if (++operations % every != 0)
+            return nullptr;
+        return (get ? get_latency_ : set_latency_).load(std::memory_order_acquire);
+    }
+
+    cache_stats snapshot() const
+    {
+        cache_stats stats;
+        uint64_t totals[counters] = {};
+        for (const auto& s : stripes_)
+        {
+            for (int c = 0; c < counters; ++c)
+                totals[c] += s.counts_[c].load(std::memory_order_relaxed);
+        }
+        stats.hits_ = totals[hits];
+        stats.misses_ = totals[misses];
+        stats.expired_ = totals[expired];
+        stats.evictions_ = totals[evictions];
+        stats.inserts_ = totals[inserts];
+        stats.replacements_ = totals[replacements];
+        stats.refresh_failures_ = totals[refresh_failures];
+
+        if (latency_histogram* h = get_latency_.load(std::memory_order_acquire))
+            h->add_to(stats.get_latency_.counts_);
+        if (latency_histogram* h = set_latency_.load(std::memory_order_acquire))
+            h->add_to(stats.set_latency_.counts_);
+        return stats;
+    }
+
+    void reset()
+    {
+        for (auto& s : stripes_)
+        {
+            for (auto& count : s.counts_)
+                count.store(0, std::memory_order_relaxed);
+        }
+        if (latency_histogram* h = get_latency_.load(std::memory_order_acquire))
+            h->reset();
+        if (latency_histogram* h = set_latency_.load(std::memory_order_acquire))
+            h->reset();
+    }
+
+private:
+    static int stripe_index()
+    {
+        static thread_local int index =
+            static_cast<int>(mix_hash(std::hash<std::thread::id>()(std::this_thread::get_id())) % stripes);
+        return index;
+    }
+};
+
+const int cache_counters::stripes;
+
+// sampled_timer times its scope into a histogram picked by
+// cache_counters::sample, doing nothing when the operation is not sampled.
+class sampled_timer : public Noncopyable
+{
+private:
+    latency_histogram* histogram_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    explicit sampled_timer(latency_histogram* histogram)
+        : histogram_(histogram)
+    {
+        if (histogram_ != nullptr)
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~sampled_timer()
+    {
+        if (histogram_ != nullptr)
+            histogram_->record(std::chrono::steady_clock::now() - start_);
+    }
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "head.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+template<typename T = void>
+class Task;
+
+// task_promise_base is the part of a Task's promise that does not depend
+// on the result: where to go once the body has finished, and the exception
+// it threw.
+struct task_promise_base
+{
+    // final_awaiter hands the thread straight to the coroutine awaiting the
+    // task, by symmetric transfer, so chains of tasks do not grow the stack.
+    struct final_awaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template<typename promise_t>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> task) noexcept
+        {
+            std::coroutine_handle<> continuation = task.promise().continuation_;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr exception_;
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    final_awaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        exception_ = std::current_exception();
+    }
+};
+
+template<typename T>
+struct task_promise : task_promise_base
+{
+    std::optional<T> value_;
+
+    Task<T> get_return_object();
+
+    template<typename U>
+    void return_value(U&& value)
+    {
+        value_.emplace(std::forward<U>(value));
+    }
+};
+
+template<>
+struct task_promise<void> : task_promise_base
+{
+    Task<void> get_return_object();
+
+    void return_void()
+    {
+    }
+};
+
+/// <summary>
+/// Task is a lazy coroutine returning T: it starts when awaited, resumes
+/// its awaiter once it finishes and owns its frame, so destroying a Task
+/// that is suspended somewhere destroys the frame and everything the body
+/// was waiting on. A root task, awaited by no one, is run with Start and
+/// checked with Done.
+/// </summary>
+template<typename T>
+class Task
+{
+public:
+    using promise_type = task_promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+private:
+    handle_type handle_;
+
+public:
+    Task() = default;
+
+    explicit Task(handle_type handle)
+        : handle_(handle)
+    {
+    }
+
+    Task(Task&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr))
+    {
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    handle_type GetHandle() const
+    {
+        return handle_;
+    }
+
+    // Start runs a root task until it first suspends.
+    void Start()
+    {
+        handle_.resume();
+    }
+
+    bool Done() const
+    {
+        return !handle_ || handle_.done();
+    }
+
+    // Result returns what a finished task returned, or rethrows what it
+    // threw.
+    T Result()
+    {
+        promise_type& promise = handle_.promise();
+        if (promise.exception_)
+            std::rethrow_exception(promise.exception_);
+
+        if constexpr (std::is_void<T>::value)
+            return;
+        else
+            return std::move(*promise.value_);
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct awaiter
+        {
+            Task& task_;
+
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                task_.handle_.promise().continuation_ = awaiting;
+                return task_.handle_;
+            }
+
+            T await_resume()
+            {
+                return task_.Result();
+            }
+        };
+        return awaiter{*this};
+    }
+};
+
+template<typename T>
+Task<T> task_promise<T>::get_return_object()
+{
+    return Task<T>(Task<T>::handle_type::from_promise(*this));
+}
+
+inline Task<void> task_promise<void>::get_return_object()
+{
+    return Task<void>(Task<void>::handle_type::from_promise(*this));
+}
@@ -0,0 +1,503 @@
+#pragma once
+
+#include "head.hpp"
+#include "bench.hpp"
+#include "inline_function.hpp"
+#include "singleton.hpp"
+#include "waitgroup.hpp"
+
+#include <cmath>
+#include <deque>
+
+/// <summary>
+/// ws_deque is a Chase-Lev work-stealing deque (the C11 version of Le et
+/// al.): its owner pushes and pops at the bottom, LIFO, without a CAS but
+/// on the last item; any thread steals from the top, FIFO, with one CAS.
+/// The ring grows when full; old rings are kept until the deque goes since
+/// a thief may still be reading one.
+/// </summary>
+template<typename T>
+class ws_deque : public Noncopyable
+{
+private:
+    struct ring
+    {
+        int64_t mask_;
+        std::unique_ptr<std::atomic<T*>[]> items_;
+
+        explicit ring(int64_t capacity)
+            : mask_(capacity - 1)
+            , items_(new std::atomic<T*>[capacity])
+        {
+        }
+
+        T* get(int64_t i) const
+        {
+            return items_[i & mask_].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T* item)
+        {
+            items_[i & mask_].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::atomic<ring*> ring_;
+    std::vector<std::unique_ptr<ring>> rings_; // owner only
+
+public:
+    explicit ws_deque(int64_t capacity = 256)
+    {
+        rings_.emplace_back(new ring(capacity));
+        ring_.store(rings_.back().get(), std::memory_order_relaxed);
+    }
+
+    // push adds an item at the bottom. Owner only.
+    void push(T* item)
+    {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        ring* r = ring_.load(std::memory_order_relaxed);
+        if (b - t > r->mask_)
+            r = grow(r, t, b);
+
+        r->put(b, item);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // pop takes the newest item, or nullptr. Owner only.
+    T* pop()
+    {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        ring* r = ring_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T* item = r->get(b);
+        if (t == b)
+        {
+            // the last item: race the thieves for it
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // steal takes the oldest item, or nullptr if the deque is empty or
+    // another thread got it first. Any thread.
+    T* steal()
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+
+        T* item = ring_.load(std::memory_order_acquire)->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+
+    bool empty() const
+    {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    ring* grow(ring* old, int64_t t, int64_t b)
+    {
+        rings_.emplace_back(new ring((old->mask_ + 1) * 2));
+        ring* r = rings_.back().get();
+        for (int64_t i = t; i < b; ++i)
+            r->put(i, old->get(i));
+        ring_.store(r, std::memory_order_release);
+        return r;
+    }
+};
+
+/// <summary>
+/// ThreadPool is a fixed set of workers, each with a ws_deque. A task
+/// submitted from a worker goes to that worker's deque, one submitted from
+/// another thread to a shared queue; an idle worker takes from its own
+/// deque, then the shared queue, then steals from the others, and sleeps on
+/// a futex when there is nothing, woken only if a submit sees a sleeper.
+/// Tasks must not throw. Completion is tracked with a WaitGroup, waited on
+/// through Wait, which on a worker runs other tasks instead of blocking, so
+/// tasks may wait for the tasks they spawn.
+/// </summary>
+class ThreadPool : public Noncopyable
+{
+public:
+    using Task = inline_function<void(void)>;
+
+private:
+    struct pool_task
+    {
+        Task task_;
+    };
+
+    struct worker
+    {
+        ws_deque<pool_task> deque_;
+        std::thread thread_;
+    };
+
+    // current is the worker the calling thread is, if any.
+    struct current
+    {
+        ThreadPool* pool_{nullptr};
+        int index_{-1};
+    };
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::mutex shared_mutex_;
+    std::deque<pool_task*> shared_; // tasks submitted from other threads
+    std::atomic<int> shared_size_{0};
+    std::atomic<int> epoch_{0};    // futex word the idle workers sleep on
+    std::atomic<int> sleepers_{0};
+    std::atomic<bool> stopped_{false};
+
+public:
+    explicit ThreadPool(int threads = static_cast<int>(std::thread::hardware_concurrency()))
+    {
+        threads = std::max(threads, 1);
+        for (int i = 0; i < threads; ++i)
+            workers_.emplace_back(new worker());
+        for (int i = 0; i < threads; ++i)
+            workers_[i]->thread_ = std::thread(&ThreadPool::run, this, i);
+    }
+
+    // the destructor runs the tasks still queued, then joins the workers
+    ~ThreadPool()
+    {
+        stopped_.store(true, std::memory_order_seq_cst);
+        epoch_.fetch_add(1, std::memory_order_seq_cst);
+        futex_wake(epoch_);
+        for (auto& w : workers_)
+            w->thread_.join();
+    }
+
+    int Size() const
+    {
+        return static_cast<int>(workers_.size());
+    }
+
+    template<typename F>
+    void Submit(F&& f)
+    {
+        pool_task* task = new pool_task{Task(std::forward<F>(f))};
+        const current& self = self_slot();
+        if (self.pool_ == this)
+        {
+            workers_[self.index_]->deque_.push(task);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(shared_mutex_);
+            shared_.push_back(task);
+            shared_size_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0)
+        {
+            epoch_.fetch_add(1, std::memory_order_seq_cst);
+            futex_wake(epoch_, 1);
+        }
+    }
+
+    // Submit runs f as part of wg, which it adds to.
+    template<typename F>
+    void Submit(WaitGroup& wg, F&& f)
+    {
+        wg.Add(1);
+        Submit([&wg, f = std::forward<F>(f)]() mutable {
+            f();
+            wg.Done();
+        });
+    }
+
+    // Wait returns once wg is done. A worker runs queued tasks meanwhile.
+    void Wait(WaitGroup& wg)
+    {
+        const current& self = self_slot();
+        if (self.pool_ != this)
+        {
+            wg.Wait();
+            return;
+        }
+
+        while (wg.Count() > 0)
+        {
+            if (pool_task* task = take(self.index_))
+                execute(task);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    static current& self_slot()
+    {
+        static thread_local current self;
+        return self;
+    }
+
+    static void execute(pool_task* task)
+    {
+        task->task_();
+        delete task;
+    }
+
+    // take finds a task for worker `index`: its own newest, the oldest
+    // submitted from outside, or one stolen from another worker.
+    pool_task* take(int index)
+    {
+        if (pool_task* task = workers_[index]->deque_.pop())
+            return task;
+
+        if (shared_size_.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(shared_mutex_);
+            if (!shared_.empty())
+            {
+                pool_task* task = shared_.front();
+                shared_.pop_front();
+                shared_size_.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+
+        const int count = Size();
+        const int start = static_cast<int>(fast_rand() % count);
+        for (int i = 0; i < count; ++i)
+        {
+            const int victim = (start + i) % count;
+            if (victim == index)
+                continue;
+            if (pool_task* task = workers_[victim]->deque_.steal())
+                return task;
+        }
+        return nullptr;
+    }
+
+    void run(int index)
+    {
+        self_slot() = current{this, index};
+        while (true)
+        {
+            pool_task* task = nullptr;
+            for (int i = 0; i < idle_rounds && task == nullptr; ++i)
+            {
+                task = take(index);
+                if (task == nullptr)
+                    std::this_thread::yield();
+            }
+            if (task != nullptr)
+            {
+                execute(task);
+                continue;
+            }
+
+            // announce the sleep, then look once more: a submit either sees
+            // the sleeper and bumps the epoch or its task is found here
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const int epoch = epoch_.load(std::memory_order_seq_cst);
+            task = take(index);
+            const bool stopped = stopped_.load(std::memory_order_seq_cst);
+            if (task == nullptr && !stopped)
+                futex_wait(epoch_, epoch, nullptr);
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+
+            if (task != nullptr)
+                execute(task);
+            else if (stopped)
+                return;
+        }
+    }
+
+    static const int idle_rounds = 16; // steal attempts before sleeping
+};
+
+const int ThreadPool::idle_rounds;
+
+// parallel_range splits [begin, end) in halves down to `grain`, submitting
+// the right halves and running the leftmost chunk itself, so a range fans
+// out in log(n / grain) steps and idle workers steal the biggest halves.
+template<typename F>
+struct parallel_range
+{
+    ThreadPool& pool_;
+    WaitGroup& wg_;
+    std::size_t grain_;
+    F& f_;
+
+    void run(std::size_t begin, std::size_t end)
+    {
+        while (end - begin > grain_)
+        {
+            const std::size_t mid = begin + (end - begin) / 2;
+            pool_.Submit(wg_, [this, mid, end]() { run(mid, end); });
+            end = mid;
+        }
+        f_(begin, end);
+    }
+};
+
+// parallel_for calls f(chunk_begin, chunk_end) over [begin, end) in chunks
+// of at most `grain` on the pool and returns when all are done.
+template<typename F>
+void parallel_for(ThreadPool& pool, std::size_t begin, std::size_t end, std::size_t grain, F&& f)
+{
+    if (begin >= end)
+        return;
+
+    WaitGroup wg;
+    parallel_range<typename std::remove_reference<F>::type> range{pool, wg, std::max<std::size_t>(grain, 1), f};
+    range.run(begin, end);
+    pool.Wait(wg);
+}
+
+// parallel_reduce maps each chunk of [begin, end) to map(chunk_begin,
+// chunk_end) in parallel and folds the results with reduce, left to right
+// from `identity`, so the result does not depend on the scheduling.
+template<typename T, typename Map, typename Reduce>
+T parallel_reduce(
+    ThreadPool& pool, std::size_t begin, std::size_t end, std::size_t grain, T identity, Map&& map, Reduce&& reduce)
+{
+    if (begin >= end)
+        return identity;
+
+    grain = std::max<std::size_t>(grain, 1);
+    const std::size_t chunks = (end - begin + grain - 1) / grain;
+    std::vector<T> results(chunks, identity);
+    parallel_for(pool, 0, chunks, 1, [&](std::size_t first, std::size_t last) {
+        for (std::size_t c = first; c < last; ++c)
+            results[c] = map(begin + c * grain, std::min(end, begin + (c + 1) * grain));
+    });
+
+    T total = identity;
+    for (T& result : results)
+        total = reduce(std::move(total), std::move(result));
+    return total;
+}
+
+void thread_pool_test()
+{
+    std::cout << "-----------------thread_pool_test-------------------" << std::endl;
+
+    ThreadPool pool(4);
+
+    WaitGroup wg;
+    std::atomic<int> submitted{0};
+    for (int i = 0; i < 1000; ++i)
+        pool.Submit(wg, [&submitted]() { submitted++; });
+    pool.Wait(wg);
+
+    std::vector<int> values(1000000);
+    parallel_for(pool, 0, values.size(), 1000, [&values](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+            values[i] = static_cast<int>(i % 7);
+    });
+    const int64_t sum = parallel_reduce(
+        pool, 0, values.size(), 4096, int64_t(0),
+        [&values](std::size_t begin, std::size_t end) {
+            int64_t s = 0;
+            for (std::size_t i = begin; i < end; ++i)
+                s += values[i];
+            return s;
+        },
+        [](int64_t a, int64_t b) { return a + b; });
+
+    // nested: every task of the outer loop runs an inner parallel_for
+    std::atomic<int> nested{0};
+    parallel_for(pool, 0, 64, 1, [&pool, &nested](std::size_t, std::size_t) {
+        parallel_for(pool, 0, 100, 10, [&nested](std::size_t begin, std::size_t end) {
+            nested += static_cast<int>(end - begin);
+        });
+    });
+
+    std::cout << "submitted : " << submitted << ", parallel_reduce sum = " << sum
+              << " (expect 2999997), nested parallel_for : " << nested << std::endl;
+}
+
+// thread_pool_bench_run times parallel_for over `count` items of `work`
+// spins each, in chunks of `grain`, on pools of 1 to 2x the CPUs, against
+// a plain loop.
+void thread_pool_bench_run(const char* name, std::size_t count, std::size_t grain, int work)
+{
+    std::vector<double> values(count, 1.0);
+    auto kernel = [&values, work](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            double v = values[i];
+            for (int w = 0; w < work; ++w)
+                v = std::sqrt(v + w);
+            values[i] = v;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    kernel(0, count);
+    const auto serial = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << "\titems = " << count << "\tgrain = " << grain
+              << "\tserial = " << std::chrono::duration_cast<std::chrono::microseconds>(serial).count() << "us";
+    const int cpus = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int threads = 1; threads <= 2 * cpus; threads *= 2)
+    {
+        ThreadPool pool(threads);
+        start = std::chrono::steady_clock::now();
+        parallel_for(pool, 0, count, grain, kernel);
+        const auto parallel = std::chrono::steady_clock::now() - start;
+        std::cout << "\t" << threads << "t = " << std::chrono::duration_cast<std::chrono::microseconds>(parallel).count()
+                  << "us";
+    }
+    std::cout << std::endl;
+}
+
+// thread_pool_spawn_bench compares running `count` empty jobs on the pool
+// with starting a thread for each, as wait_group_test does.
+void thread_pool_spawn_bench(int count)
+{
+    ThreadPool pool;
+    WaitGroup wg;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+        pool.Submit(wg, []() {});
+    pool.Wait(wg);
+    const auto pooled = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        wg.Add(1);
+        std::thread([&wg]() { wg.Done(); }).detach();
+    }
+    wg.Wait();
+    const auto spawned = std::chrono::steady_clock::now() - start;
+
+    std::cout << "jobs = " << count << "\tpool submit = " << pooled.count() / count
+              << "ns per job\tthread per job = " << spawned.count() / count << "ns per job" << std::endl;
+}
+
+void thread_pool_bench()
+{
+    std::cout << "-------------------thread pool: parallel_for scaling---------------------" << std::endl;
+    thread_pool_bench_run("fine", 10000000, 1000, 1);
+    thread_pool_bench_run("medium", 1000000, 1000, 20);
+    thread_pool_bench_run("coarse", 64, 1, 200000);
+    std::cout << "-------------------thread pool: submit vs thread per job---------------------" << std::endl;
+    thread_pool_spawn_bench(10000);
+}
@@ -1,30 +1,139 @@
 #pragma once
 
 #include "head.hpp"
+#include "bench.hpp"
+#include "inline_function.hpp"
+#include "singleton.hpp"
+#include "stats.hpp"
+#include "task.hpp"
 
-class TimerMgr;
+#include <limits>
 
+class Timer;
+class timer_pool;
+
+// roundest returns the value in [lo, hi] with the most trailing zero bits.
+// Timers with slack fire at the roundest instant of their window, so timers
+// whose windows overlap tend to land on the same instant and share a
+// wakeup.
+inline int64_t roundest(int64_t lo, int64_t hi)
+{
+    if (hi <= lo)
+        return lo;
+
+    const int bit = 63 - __builtin_clzll(static_cast<uint64_t>(lo ^ hi));
+    return hi & ~((int64_t(1) << bit) - 1);
+}
+
+// TimerQueue is the part of a timer backend that an armed Timer calls back
+// into, so cancelling it can unlink it right away.
+class TimerQueue
+{
+public:
+    virtual ~TimerQueue() = default;
+
+    virtual void Remove(Timer& timer) = 0;
+};
+
+/// <summary>
+/// Timer is one timer of a BasicTimerMgr. Timers live in the manager's
+/// slab pool and go back to it once fired or cancelled, so they are reached
+/// through a Handle, which knows the generation of the timer it was made
+/// for and turns stale once the slot is reused. Handles must not outlive
+/// their manager. A Timer can also be owned by the caller, embedded in
+/// another object such as a coroutine frame; destroying an armed one
+/// cancels it.
+/// </summary>
 class Timer final
 {
 public:
-    using Ptr = std::shared_ptr<Timer>;
-    using WeakPtr = std::weak_ptr<Timer>;
-    using Callback = std::function<void(void)>;
+    using Callback = inline_function<void(void)>;
+
+    // Missed says what a periodic timer does with the periods that went by
+    // while it was not scheduled: Skip fires once and goes on from the next
+    // period still ahead, CatchUp fires once for every period.
+    enum class Missed
+    {
+        Skip,
+        CatchUp
+    };
+
+    class Handle
+    {
+    private:
+        Timer* timer_{nullptr};
+        uint32_t generation_{0};
+
+    public:
+        Handle() = default;
+
+        explicit Handle(Timer* timer)
+            : timer_(timer)
+            , generation_(timer->generation_)
+        {
+        }
+
+        // Get returns the timer, or nullptr once it has fired or been
+        // cancelled.
+        Timer* Get() const
+        {
+            return timer_ != nullptr && timer_->generation_ == generation_ ? timer_ : nullptr;
+        }
+
+        bool Expired() const
+        {
+            return Get() == nullptr;
+        }
+
+        void Cancel() const
+        {
+            if (Timer* timer = Get())
+                timer->Cancel();
+        }
+    };
 
 private:
-    std::once_flag once_;
+    enum class state : uint8_t
+    {
+        idle,    // in the pool, or not yet armed
+        armed,   // in a backend
+        running, // its callback is running, periodic timers only
+    };
+
     Callback callback_;
-    const std::chrono::steady_clock::time_point start_time_;
-    const std::chrono::nanoseconds last_time_;
+    std::chrono::steady_clock::time_point start_time_;
+    std::chrono::nanoseconds last_time_{0};
+    std::chrono::nanoseconds period_{0}; // zero for a one-shot timer
+    std::chrono::nanoseconds slack_{0};  // how late the timer may fire
+    uint32_t generation_{0};             // bumped when the timer goes back to the pool
+    Missed missed_{Missed::Skip};
+    state state_{state::idle};
+    bool cancelled_{false}; // cancelled while running
+    timer_pool* pool_{nullptr};
+
+    // backend bookkeeping while the timer is armed
+    TimerQueue* queue_{nullptr};
+    Timer* prev_{nullptr};
+    Timer* next_{nullptr};
+    int64_t expires_{0};   // wheel tick
+    int slot_{-1};         // wheel slot, -1 for the due list
+    std::size_t index_{0}; // heap position
 
-    friend class TimerMgr;
+    template<typename queue_t>
+    friend class BasicTimerMgr;
+    friend class timer_pool;
+    friend class heap_timer_queue;
+    friend class wheel_timer_queue;
 
 public:
-    Timer(std::chrono::steady_clock::time_point startTime, std::chrono::nanoseconds lastTime, Callback&& callback)
-        : callback_(std::move(callback))
-        , start_time_(startTime)
-        , last_time_(lastTime)
+    Timer() = default;
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    ~Timer()
     {
+        if (state_ == state::armed)
+            queue_->Remove(*this);
     }
 
     const std::chrono::steady_clock::time_point& GetStartTime() const
@@ -37,64 +146,778 @@ public:
         return last_time_;
     }
 
+    std::chrono::steady_clock::time_point GetDeadline() const
+    {
+        return start_time_ + last_time_;
+    }
+
     std::chrono::nanoseconds GetLeftTime() const
     {
         const auto now = std::chrono::steady_clock::now();
         return GetLastTime() - (now - GetStartTime());
     }
 
+    // GetPeriod returns zero for a one-shot timer.
+    const std::chrono::nanoseconds& GetPeriod() const
+    {
+        return period_;
+    }
+
+    // GetSlack returns how late after its deadline the timer may fire.
+    const std::chrono::nanoseconds& GetSlack() const
+    {
+        return slack_;
+    }
+
+    // Cancel unlinks an armed timer and frees its callback. A periodic timer
+    // cancelled from its own callback is released once the callback
+    // returns.
     void Cancel()
     {
-        std::call_once(once_, [this]() { callback_ = nullptr; });
+        if (state_ == state::running)
+        {
+            cancelled_ = true;
+        }
+        else if (state_ == state::armed)
+        {
+            queue_->Remove(*this);
+            finish();
+        }
     }
 
 private:
-    void operator()()
+    // expiry is when the timer is set to fire: its deadline, or with slack
+    // the roundest instant up to slack later.
+    std::chrono::steady_clock::time_point expiry() const
     {
-        Callback callback;
-        std::call_once(once_, [&callback, this]() {
-            callback = std::move(callback_);
-            callback_ = nullptr;
-        });
+        const auto deadline = GetDeadline();
+        if (slack_ <= std::chrono::nanoseconds::zero())
+            return deadline;
+
+        const int64_t lo = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        const std::chrono::nanoseconds at(roundest(lo, lo + slack_.count()));
+        return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(at));
+    }
+
+    // finish frees the callback and gives the timer back to its pool.
+    void finish();
 
-        if (callback != nullptr)
+    // fire runs the callback of a timer popped from its backend. A one-shot
+    // timer is finished before its callback runs, so the callback may
+    // destroy the object the timer is embedded in, as resuming a coroutine
+    // does. A periodic timer moves its deadline on from the ideal one, not
+    // from `now`, so lateness does not add up, and keeps its callback; fire
+    // returns whether to arm it again, otherwise the timer is finished.
+    bool fire(std::chrono::steady_clock::time_point now)
+    {
+        if (period_ == std::chrono::nanoseconds::zero())
+        {
+            Callback callback = std::move(callback_);
+            finish();
             callback();
+            return false;
+        }
+
+        const auto deadline = GetDeadline();
+        start_time_ = deadline;
+        last_time_ = period_;
+        if (missed_ == Missed::Skip && now >= deadline)
+            start_time_ += (now - deadline) / period_ * period_;
+
+        state_ = state::running;
+        callback_();
+        if (!cancelled_)
+            return true;
+
+        finish();
+        return false;
     }
 };
 
-class TimerMgr final
+/// <summary>
+/// timer_pool is a slab of timers: chunks of 256 that are never freed while
+/// the pool lives, so Timer pointers and handles stay valid, and a free
+/// list, so arming a timer allocates only while the pool grows.
+/// </summary>
+class timer_pool : public Noncopyable
 {
 private:
-    class CompareTimer
+    static const std::size_t chunk_size = 256;
+
+    std::vector<std::unique_ptr<Timer[]>> chunks_;
+    Timer* free_{nullptr}; // linked through next_
+
+public:
+    Timer* acquire()
     {
-    public:
-        bool operator()(const Timer::Ptr& left, const Timer::Ptr& right) const
+        if (free_ == nullptr)
+            grow();
+
+        Timer* timer = free_;
+        free_ = timer->next_;
+        timer->next_ = nullptr;
+        timer->pool_ = this;
+        return timer;
+    }
+
+    void release(Timer* timer)
+    {
+        timer->next_ = free_;
+        free_ = timer;
+    }
+
+private:
+    void grow()
+    {
+        chunks_.emplace_back(new Timer[chunk_size]);
+        Timer* chunk = chunks_.back().get();
+        for (std::size_t i = chunk_size; i > 0; --i)
         {
-            const auto startDiff = left->GetStartTime() - right->GetStartTime();
-            const auto lastDiff = left->GetStartTime() - right->GetStartTime();
-            const auto diff = startDiff.count() + lastDiff.count();
-            return diff > 0;
+            release(&chunk[i - 1]);
         }
+    }
+};
+
+const std::size_t timer_pool::chunk_size;
+
+inline void Timer::finish()
+{
+    callback_ = nullptr;
+    state_ = state::idle;
+    cancelled_ = false;
+    generation_++;
+    if (pool_ != nullptr)
+        pool_->release(this);
+}
+
+// Timer backends. A backend links the armed timers, without owning them,
+// unlinks a cancelled one through TimerQueue::Remove and hands the others
+// back once due:
+//
+//   void   push(timer)                     arm a timer
+//   void   update(timer)                   move an armed timer whose
+//                                          deadline has changed
+//   Timer* pop_due(now)                    next timer due at `now`, or null
+//   std::chrono::nanoseconds left(now)     time to the next due timer, zero
+//                                          if empty; may undershoot, never
+//                                          overshoot
+//   bool   empty()
+//   void   clear(timers)                   unlink all, appending them to timers
+
+/// <summary>
+/// heap_timer_queue keeps the timers in an indexed 4-ary heap by expiry
+/// (the deadline, or with slack the instant picked in the slack window).
+/// Every timer knows its position, so cancelling or moving one is O(log n)
+/// like push and pop, and a cancelled timer leaves the heap at once. The
+/// expiries sit in the heap array, comparing them does not touch the
+/// timers.
+/// </summary>
+class heap_timer_queue : public TimerQueue
+{
+private:
+    static const std::size_t arity = 4;
+
+    struct entry
+    {
+        std::chrono::steady_clock::time_point deadline_;
+        Timer* timer_;
     };
 
-    // priority_queue : 优先队列，类似heap
-    std::priority_queue<Timer::Ptr, std::vector<Timer::Ptr>, CompareTimer> timers_;
+    std::vector<entry> heap_;
 
 public:
-    using Ptr = std::shared_ptr<TimerMgr>;
+    void push(Timer* timer)
+    {
+        timer->queue_ = this;
+        timer->index_ = heap_.size();
+        heap_.push_back({timer->expiry(), timer});
+        sift_up(heap_.size() - 1);
+    }
 
-    template<typename F, typename... TArgs>
-    Timer::WeakPtr AddTimer(std::chrono::nanoseconds timeout, F&& callback, TArgs&&... args)
+    void update(Timer& timer)
     {
-        auto timer = std::make_shared<Timer>(std::chrono::steady_clock::now(), std::chrono::nanoseconds(timeout),
-            std::bind(std::forward<F>(callback), std::forward<TArgs>(args)...));
-        timers_.push(timer);
+        const std::size_t index = timer.index_;
+        const auto deadline = timer.expiry();
+        const bool earlier = deadline < heap_[index].deadline_;
+        heap_[index].deadline_ = deadline;
+        earlier ? sift_up(index) : sift_down(index);
+    }
+
+    Timer* pop_due(std::chrono::steady_clock::time_point now)
+    {
+        if (heap_.empty() || heap_.front().deadline_ > now)
+            return nullptr;
+
+        return take(0);
+    }
+
+    std::chrono::nanoseconds left(std::chrono::steady_clock::time_point now) const
+    {
+        if (heap_.empty())
+            return std::chrono::nanoseconds::zero();
+
+        return std::max(heap_.front().deadline_ - now, std::chrono::steady_clock::duration::zero());
+    }
+
+    bool empty() const
+    {
+        return heap_.empty();
+    }
+
+    void clear(std::vector<Timer*>& timers)
+    {
+        for (entry& e : heap_)
+        {
+            e.timer_->queue_ = nullptr;
+            timers.push_back(e.timer_);
+        }
+        heap_.clear();
+    }
+
+    // Remove takes a cancelled timer out of the heap.
+    void Remove(Timer& timer) override
+    {
+        take(timer.index_);
+    }
+
+private:
+    // take removes the timer at `index`, filling the hole with the last one.
+    Timer* take(std::size_t index)
+    {
+        Timer* timer = heap_[index].timer_;
+        timer->queue_ = nullptr;
+        if (index + 1 != heap_.size())
+        {
+            const bool earlier = heap_.back().deadline_ < heap_[index].deadline_;
+            heap_[index] = std::move(heap_.back());
+            heap_.pop_back();
+            earlier ? sift_up(index) : sift_down(index);
+        }
+        else
+        {
+            heap_.pop_back();
+        }
         return timer;
     }
 
-    void AddTimer(const Timer::Ptr& timer)
+    void place(std::size_t index, entry&& e)
     {
-        timers_.push(timer);
+        e.timer_->index_ = index;
+        heap_[index] = std::move(e);
+    }
+
+    void sift_up(std::size_t index)
+    {
+        entry e = std::move(heap_[index]);
+        while (index > 0)
+        {
+            const std::size_t parent = (index - 1) / arity;
+            if (!(e.deadline_ < heap_[parent].deadline_))
+                break;
+
+            place(index, std::move(heap_[parent]));
+            index = parent;
+        }
+        place(index, std::move(e));
+    }
+
+    void sift_down(std::size_t index)
+    {
+        entry e = std::move(heap_[index]);
+        const std::size_t size = heap_.size();
+        while (true)
+        {
+            const std::size_t first = index * arity + 1;
+            if (first >= size)
+                break;
+
+            std::size_t child = first;
+            const std::size_t last = std::min(first + arity, size);
+            for (std::size_t i = first + 1; i < last; ++i)
+            {
+                if (heap_[i].deadline_ < heap_[child].deadline_)
+                    child = i;
+            }
+            if (!(heap_[child].deadline_ < e.deadline_))
+                break;
+
+            place(index, std::move(heap_[child]));
+            index = child;
+        }
+        place(index, std::move(e));
+    }
+};
+
+const std::size_t heap_timer_queue::arity;
+
+/// <summary>
+/// wheel_timer_queue is a hierarchical timing wheel: 256 slots of one tick,
+/// then four levels of 64 slots each 64 times coarser, about 49 days at the
+/// default 1ms tick (later deadlines wait in the last level and go round
+/// again). Push and cancel are O(1): a timer is linked into the slot of its
+/// deadline tick and unlinked from it. A timer in an upper level moves one
+/// level down each time the level below wraps, so expiry is amortized O(1)
+/// per timer, and empty stretches of the wheel are skipped with the slot
+/// bitmaps. Timers fire on the first tick at or after their deadline: up to
+/// one tick late, never early.
+/// </summary>
+class wheel_timer_queue : public TimerQueue
+{
+private:
+    static const int levels = 5;
+    static const int level0_bits = 8;
+    static const int level_bits = 6;
+    static const int level0_slots = 1 << level0_bits;
+    static const int level_slots = 1 << level_bits;
+    static const int slot_count = level0_slots + (levels - 1) * level_slots;
+
+    std::chrono::steady_clock::time_point origin_;
+    std::chrono::nanoseconds tick_;
+    int64_t current_{0}; // next tick to process
+
+    Timer* slots_[slot_count] = {};
+    uint64_t occupied_[slot_count / 64] = {}; // bitmap of the non-empty slots
+    Timer* due_{nullptr};                      // timers due now, in firing order
+    Timer* due_tail_{nullptr};
+    std::size_t size_{0};     // all armed timers
+    std::size_t in_wheel_{0}; // armed timers in slots_
+
+public:
+    explicit wheel_timer_queue(std::chrono::nanoseconds tick = std::chrono::milliseconds(1))
+        : origin_(std::chrono::steady_clock::now())
+        , tick_(tick)
+    {
+    }
+
+    void push(Timer* timer)
+    {
+        timer->expires_ = expires_of(*timer);
+        timer->queue_ = this;
+        size_++;
+        link(timer);
+    }
+
+    void update(Timer& timer)
+    {
+        unlink(&timer);
+        timer.expires_ = expires_of(timer);
+        link(&timer);
+    }
+
+    Timer* pop_due(std::chrono::steady_clock::time_point now)
+    {
+        if (due_ == nullptr)
+            advance(tick_of(now));
+        if (due_ == nullptr)
+            return nullptr;
+
+        Timer* timer = due_;
+        unlink(timer);
+        size_--;
+        timer->queue_ = nullptr;
+        return timer;
+    }
+
+    std::chrono::nanoseconds left(std::chrono::steady_clock::time_point now) const
+    {
+        if (due_ != nullptr || size_ == 0)
+            return std::chrono::nanoseconds::zero();
+
+        auto at = origin_ + next_event() * tick_;
+        return std::max(at - now, std::chrono::steady_clock::duration::zero());
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    void clear(std::vector<Timer*>& timers)
+    {
+        for (Timer*& head : slots_)
+        {
+            take_all(head, timers);
+        }
+        take_all(due_, timers);
+        due_tail_ = nullptr;
+        std::fill(std::begin(occupied_), std::end(occupied_), 0);
+        size_ = in_wheel_ = 0;
+    }
+
+    // Remove unlinks a cancelled timer.
+    void Remove(Timer& timer) override
+    {
+        unlink(&timer);
+        size_--;
+        timer.queue_ = nullptr;
+    }
+
+private:
+    int64_t tick_of(std::chrono::steady_clock::time_point time) const
+    {
+        return (time - origin_) / tick_;
+    }
+
+    // expires_of rounds the deadline up, a timer never fires early, then
+    // takes the roundest tick its slack allows.
+    int64_t expires_of(const Timer& timer) const
+    {
+        const auto offset = timer.GetDeadline() - origin_;
+        const int64_t lo = offset.count() <= 0 ? 0 : (offset.count() + tick_.count() - 1) / tick_.count();
+        const int64_t hi = std::max<int64_t>(0, (offset + timer.GetSlack()) / tick_);
+        return roundest(lo, hi);
+    }
+
+    static int shift(int level)
+    {
+        return level == 0 ? 0 : level0_bits + (level - 1) * level_bits;
+    }
+
+    static int slot_of(int level, int64_t tick)
+    {
+        if (level == 0)
+            return static_cast<int>(tick & (level0_slots - 1));
+        return level0_slots + (level - 1) * level_slots + static_cast<int>((tick >> shift(level)) & (level_slots - 1));
+    }
+
+    // link files a timer by the distance to its tick, in the due list if it
+    // is already due.
+    void link(Timer* timer)
+    {
+        const int64_t delta = timer->expires_ - current_;
+        if (delta < 0)
+        {
+            timer->slot_ = -1;
+            timer->prev_ = due_tail_;
+            timer->next_ = nullptr;
+            (due_tail_ != nullptr ? due_tail_->next_ : due_) = timer;
+            due_tail_ = timer;
+            return;
+        }
+
+        int level = 0;
+        while (level < levels - 1 && delta >= (int64_t(1) << (shift(level + 1))))
+        {
+            level++;
+        }
+        // beyond the wheel: park in the furthest slot, it goes round again
+        const int64_t span = int64_t(1) << (shift(levels - 1) + level_bits);
+        const int64_t tick = delta >= span ? current_ + span - 1 : timer->expires_;
+        const int slot = slot_of(level, tick);
+        timer->slot_ = slot;
+        timer->prev_ = nullptr;
+        timer->next_ = slots_[slot];
+        if (slots_[slot] != nullptr)
+            slots_[slot]->prev_ = timer;
+        slots_[slot] = timer;
+        occupied_[slot / 64] |= uint64_t(1) << (slot % 64);
+        in_wheel_++;
+    }
+
+    void unlink(Timer* timer)
+    {
+        if (timer->slot_ < 0)
+        {
+            (timer->prev_ != nullptr ? timer->prev_->next_ : due_) = timer->next_;
+            (timer->next_ != nullptr ? timer->next_->prev_ : due_tail_) = timer->prev_;
+        }
+        else
+        {
+            const int slot = timer->slot_;
+            (timer->prev_ != nullptr ? timer->prev_->next_ : slots_[slot]) = timer->next_;
+            if (timer->next_ != nullptr)
+                timer->next_->prev_ = timer->prev_;
+            if (slots_[slot] == nullptr)
+                occupied_[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+            in_wheel_--;
+        }
+        timer->prev_ = timer->next_ = nullptr;
+    }
+
+    // relink empties a slot and files its timers again from the current
+    // tick: due ones go to the due list, the others one level down.
+    void relink(int slot)
+    {
+        Timer* timer = slots_[slot];
+        slots_[slot] = nullptr;
+        occupied_[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        while (timer != nullptr)
+        {
+            Timer* next = timer->next_;
+            in_wheel_--;
+            link(timer);
+            timer = next;
+        }
+    }
+
+    // next_slot returns how far past slot `from` the next occupied slot is,
+    // going round the `count` slots of a level that starts at `begin`, or -1.
+    int next_slot(int begin, int count, int from) const
+    {
+        for (int distance = 0; distance < count;)
+        {
+            const int slot = begin + (from + distance) % count;
+            const int avail = std::min({64 - slot % 64, count - (from + distance) % count, count - distance});
+            uint64_t bits = occupied_[slot / 64] >> (slot % 64);
+            if (avail < 64)
+                bits &= (uint64_t(1) << avail) - 1;
+            if (bits != 0)
+                return distance + __builtin_ctzll(bits);
+            distance += avail;
+        }
+        return -1;
+    }
+
+    // next_event returns the next tick, from current_, with level 0 timers
+    // due or an upper level slot to cascade. Only call with timers in slots_.
+    int64_t next_event() const
+    {
+        int64_t next = std::numeric_limits<int64_t>::max();
+        const int distance = next_slot(0, level0_slots, static_cast<int>(current_ & (level0_slots - 1)));
+        if (distance >= 0)
+            next = current_ + distance;
+
+        for (int level = 1; level < levels; ++level)
+        {
+            // a slot cascades when the levels below wrap round to it
+            const int64_t boundary = ((current_ + (int64_t(1) << shift(level)) - 1) >> shift(level)) << shift(level);
+            const int begin = level0_slots + (level - 1) * level_slots;
+            const int from = static_cast<int>((boundary >> shift(level)) & (level_slots - 1));
+            const int slots = next_slot(begin, level_slots, from);
+            if (slots >= 0)
+                next = std::min(next, boundary + (int64_t(slots) << shift(level)));
+        }
+        return next;
+    }
+
+    // advance processes the ticks up to now_tick, jumping straight to the
+    // ones with events, and moves what is due to the due list.
+    void advance(int64_t now_tick)
+    {
+        while (current_ <= now_tick && in_wheel_ > 0)
+        {
+            const int64_t tick = next_event();
+            if (tick > now_tick)
+                break;
+
+            current_ = tick;
+            if ((current_ & (level0_slots - 1)) == 0)
+            {
+                for (int level = 1; level < levels; ++level)
+                {
+                    relink(slot_of(level, current_));
+                    if (((current_ >> shift(level)) & (level_slots - 1)) != 0)
+                        break;
+                }
+            }
+            current_++;
+            relink(slot_of(0, tick)); // all due: their tick is now behind current_
+        }
+        if (current_ <= now_tick)
+            current_ = now_tick + 1;
+    }
+
+    void take_all(Timer*& head, std::vector<Timer*>& timers)
+    {
+        while (head != nullptr)
+        {
+            Timer* timer = head;
+            head = timer->next_;
+            timer->prev_ = timer->next_ = nullptr;
+            timer->queue_ = nullptr;
+            timers.push_back(timer);
+        }
+    }
+};
+
+const int wheel_timer_queue::levels;
+const int wheel_timer_queue::level0_bits;
+const int wheel_timer_queue::level_bits;
+const int wheel_timer_queue::level0_slots;
+const int wheel_timer_queue::level_slots;
+const int wheel_timer_queue::slot_count;
+
+// make_timer_callback stores a bare callable as is and binds one with
+// arguments.
+template<typename F, typename... TArgs>
+Timer::Callback make_timer_callback(F&& callback, TArgs&&... args)
+{
+    if constexpr (sizeof...(TArgs) == 0)
+        return Timer::Callback(std::forward<F>(callback));
+    else
+        return Timer::Callback(std::bind(std::forward<F>(callback), std::forward<TArgs>(args)...));
+}
+
+// timer_stats is a snapshot of a timer manager's counters, for tuning slack:
+// fewer wakeups firing bigger batches, at the price of lateness.
+struct timer_stats
+{
+    uint64_t schedules_{0}; // Schedule calls
+    uint64_t wakeups_{0};   // Schedule calls that fired timers
+    uint64_t fired_{0};
+    std::chrono::nanoseconds elapsed_{0}; // since the counters were reset
+    latency_stats lateness_;              // how long after its deadline each timer fired
+
+    double wakeups_per_second() const
+    {
+        return elapsed_.count() <= 0 ? 0 : wakeups_ * 1e9 / elapsed_.count();
+    }
+
+    double batch() const
+    {
+        return wakeups_ == 0 ? 0 : static_cast<double>(fired_) / wakeups_;
+    }
+};
+
+template<typename mgr_t>
+class sleep_awaiter;
+
+template<typename mgr_t, typename T>
+class timeout_awaiter;
+
+/// <summary>
+/// BasicTimerMgr runs timers on the thread calling Schedule, on the backend
+/// queue_t: heap_timer_queue (TimerMgr) or wheel_timer_queue (WheelTimerMgr).
+/// Coroutines wait on it with SleepFor and WithTimeout and are resumed from
+/// Schedule.
+/// </summary>
+template<typename queue_t>
+class BasicTimerMgr final
+{
+private:
+    timer_pool pool_;
+    queue_t timers_;
+    std::chrono::nanoseconds slack_{0}; // for new timers
+
+    // counters, relaxed atomics so Stats can be read from another thread
+    std::atomic<uint64_t> schedules_{0};
+    std::atomic<uint64_t> wakeups_{0};
+    std::atomic<uint64_t> fired_{0};
+    std::atomic<int64_t> stats_since_; // steady_clock ns
+    latency_histogram lateness_;
+
+public:
+    using Ptr = std::shared_ptr<BasicTimerMgr>;
+
+    template<typename... TQueueArgs>
+    explicit BasicTimerMgr(TQueueArgs&&... args)
+        : timers_(std::forward<TQueueArgs>(args)...)
+        , stats_since_(since_epoch(std::chrono::steady_clock::now()))
+    {
+    }
+
+    ~BasicTimerMgr()
+    {
+        Clear();
+    }
+
+    template<typename F, typename... TArgs>
+    Timer::Handle AddTimer(std::chrono::nanoseconds timeout, F&& callback, TArgs&&... args)
+    {
+        Timer* timer = arm(
+            pool_.acquire(), timeout, make_timer_callback(std::forward<F>(callback), std::forward<TArgs>(args)...));
+        return Timer::Handle(timer);
+    }
+
+    // AddTimer arms a one-shot timer the caller owns instead of one from the
+    // pool, rearming it if it is armed already. It must be cancelled or
+    // fired before the manager goes, and destroying it cancels it.
+    template<typename F>
+    Timer::Handle AddTimer(Timer& timer, std::chrono::nanoseconds timeout, F&& callback)
+    {
+        timer.Cancel();
+        arm(&timer, timeout, Timer::Callback(std::forward<F>(callback)));
+        return Timer::Handle(&timer);
+    }
+
+    // SleepFor is awaited by a coroutine to be resumed from Schedule once
+    // `timeout` has passed. Its timer lives in the awaiter, in the
+    // coroutine frame, so sleeping does not allocate.
+    sleep_awaiter<BasicTimerMgr> SleepFor(std::chrono::nanoseconds timeout)
+    {
+        return sleep_awaiter<BasicTimerMgr>(*this, timeout);
+    }
+
+    // WithTimeout is awaited to run `task` for up to `timeout`. It gives the
+    // task's result, as an std::optional or for a Task<void> as a bool,
+    // empty if the timeout came first; then the task is destroyed where it
+    // was suspended, which cancels what it was waiting on.
+    template<typename T>
+    timeout_awaiter<BasicTimerMgr, T> WithTimeout(Task<T> task, std::chrono::nanoseconds timeout)
+    {
+        return timeout_awaiter<BasicTimerMgr, T>(*this, std::move(task), timeout);
+    }
+
+    // AddPeriodicTimer runs the callback every `period`, first one period
+    // from now, until the timer is cancelled.
+    template<typename F, typename... TArgs>
+    Timer::Handle AddPeriodicTimer(std::chrono::nanoseconds period, F&& callback, TArgs&&... args)
+    {
+        return AddPeriodicTimer(period, Timer::Missed::Skip, std::forward<F>(callback), std::forward<TArgs>(args)...);
+    }
+
+    template<typename F, typename... TArgs>
+    Timer::Handle AddPeriodicTimer(
+        std::chrono::nanoseconds period, Timer::Missed missed, F&& callback, TArgs&&... args)
+    {
+        if (period <= std::chrono::nanoseconds::zero())
+            throw std::invalid_argument("AddPeriodicTimer: period must be positive");
+
+        Timer::Callback bound = make_timer_callback(std::forward<F>(callback), std::forward<TArgs>(args)...);
+        return AddPeriodicTimer(period, period, missed, std::move(bound));
+    }
+
+    // AddPeriodicTimer runs the callback first `first` from now, then every
+    // `period` after that deadline, for a caller that fixed the first
+    // deadline earlier, as TimerService does when it submits the timer.
+    Timer::Handle AddPeriodicTimer(std::chrono::nanoseconds first, std::chrono::nanoseconds period,
+        Timer::Missed missed, Timer::Callback&& callback)
+    {
+        if (period <= std::chrono::nanoseconds::zero())
+            throw std::invalid_argument("AddPeriodicTimer: period must be positive");
+
+        Timer* timer = arm(pool_.acquire(), first, std::move(callback), period, missed);
+        return Timer::Handle(timer);
+    }
+
+    // Reset restarts an armed timer with a new timeout, moving it in place.
+    // It returns false if the timer has fired, been cancelled or belongs to
+    // another manager.
+    bool Reset(const Timer::Handle& handle, std::chrono::nanoseconds timeout)
+    {
+        return Reset(handle, timeout, std::chrono::steady_clock::now());
+    }
+
+    bool Reset(const Timer::Handle& handle, std::chrono::nanoseconds timeout, std::chrono::steady_clock::time_point now)
+    {
+        Timer* timer = handle.Get();
+        if (timer == nullptr || timer->queue_ != &timers_)
+            return false;
+
+        timer->start_time_ = now;
+        timer->last_time_ = timeout;
+        timers_.update(*timer);
+        return true;
+    }
+
+    // SetSlack lets the timers added from now on fire up to `slack` after
+    // their deadline, like Linux timer slack: each fires at the roundest
+    // instant of its window, so timers close together share a wakeup.
+    void SetSlack(std::chrono::nanoseconds slack)
+    {
+        slack_ = slack;
+    }
+
+    // SetSlack changes the slack of one armed timer.
+    bool SetSlack(const Timer::Handle& handle, std::chrono::nanoseconds slack)
+    {
+        Timer* timer = handle.Get();
+        if (timer == nullptr || timer->queue_ != &timers_)
+            return false;
+
+        timer->slack_ = slack;
+        timers_.update(*timer);
+        return true;
     }
 
     bool IsEmpty() const
@@ -102,48 +925,300 @@ public:
         return timers_.empty();
     }
 
+    // Schedule runs the timers due now, one at a time, so callbacks may add
+    // and cancel timers. A periodic timer is armed again for its next period
+    // (Missed::CatchUp ones may fire again in the same call).
     void Schedule()
     {
+        Schedule(std::chrono::steady_clock::now());
+    }
 
-        while (!timers_.empty())
+    void Schedule(std::chrono::steady_clock::time_point now)
+    {
+        uint64_t fired = 0;
+        while (Timer* timer = timers_.pop_due(now))
         {
-            auto tmp = timers_.top();
-            if (tmp->GetLeftTime() > std::chrono::nanoseconds::zero())
+            fired++;
+            lateness_.record(now - timer->GetDeadline());
+            if (timer->fire(now))
             {
-                break;
+                timer->state_ = Timer::state::armed;
+                timers_.push(timer);
             }
+        }
 
-            timers_.pop();
-            (*tmp)();
+        schedules_.fetch_add(1, std::memory_order_relaxed);
+        if (fired != 0)
+        {
+            wakeups_.fetch_add(1, std::memory_order_relaxed);
+            fired_.fetch_add(fired, std::memory_order_relaxed);
         }
     }
 
     // if timer empty, return zero
     std::chrono::nanoseconds NearLeftTime() const
     {
-        if (timers_.empty())
+        return NearLeftTime(std::chrono::steady_clock::now());
+    }
+
+    std::chrono::nanoseconds NearLeftTime(std::chrono::steady_clock::time_point now) const
+    {
+        return timers_.left(now);
+    }
+
+    timer_stats Stats() const
+    {
+        timer_stats stats;
+        stats.schedules_ = schedules_.load(std::memory_order_relaxed);
+        stats.wakeups_ = wakeups_.load(std::memory_order_relaxed);
+        stats.fired_ = fired_.load(std::memory_order_relaxed);
+        stats.elapsed_ = std::chrono::nanoseconds(
+            since_epoch(std::chrono::steady_clock::now()) - stats_since_.load(std::memory_order_relaxed));
+        lateness_.add_to(stats.lateness_.counts_);
+        return stats;
+    }
+
+    void ResetStats()
+    {
+        schedules_.store(0, std::memory_order_relaxed);
+        wakeups_.store(0, std::memory_order_relaxed);
+        fired_.store(0, std::memory_order_relaxed);
+        lateness_.reset();
+        stats_since_.store(since_epoch(std::chrono::steady_clock::now()), std::memory_order_relaxed);
+    }
+
+    // Clear cancels every timer.
+    void Clear()
+    {
+        std::vector<Timer*> timers;
+        timers_.clear(timers);
+        for (Timer* timer : timers)
         {
-            return std::chrono::nanoseconds::zero();
+            timer->state_ = Timer::state::idle; // a callback freed below may cancel it
         }
-
-        auto result = timers_.top()->GetLeftTime();
-        if (result < std::chrono::nanoseconds::zero())
+        for (Timer* timer : timers)
         {
-            return std::chrono::nanoseconds::zero();
+            timer->finish();
         }
+    }
 
-        return result;
+private:
+    static int64_t since_epoch(std::chrono::steady_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
     }
 
-    void Clear()
+    Timer* arm(Timer* timer, std::chrono::nanoseconds timeout, Timer::Callback&& callback,
+        std::chrono::nanoseconds period = std::chrono::nanoseconds::zero(), Timer::Missed missed = Timer::Missed::Skip)
+    {
+        timer->callback_ = std::move(callback);
+        timer->start_time_ = std::chrono::steady_clock::now();
+        timer->last_time_ = timeout;
+        timer->period_ = period;
+        timer->slack_ = slack_;
+        timer->missed_ = missed;
+        timer->state_ = Timer::state::armed;
+        timers_.push(timer);
+        return timer;
+    }
+};
+
+using TimerMgr = BasicTimerMgr<heap_timer_queue>;
+using WheelTimerMgr = BasicTimerMgr<wheel_timer_queue>;
+
+/// <summary>
+/// sleep_awaiter suspends a coroutine on a timer it holds, resumed from the
+/// manager's Schedule. Destroying the suspended coroutine destroys the
+/// awaiter and cancels the timer.
+/// </summary>
+template<typename mgr_t>
+class sleep_awaiter : public Noncopyable
+{
+private:
+    mgr_t& timers_;
+    std::chrono::nanoseconds timeout_;
+    Timer timer_;
+
+public:
+    sleep_awaiter(mgr_t& timers, std::chrono::nanoseconds timeout)
+        : timers_(timers)
+        , timeout_(timeout)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return timeout_ <= std::chrono::nanoseconds::zero();
+    }
+
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        timers_.AddTimer(timer_, timeout_, [awaiting]() { awaiting.resume(); });
+    }
+
+    void await_resume()
+    {
+    }
+};
+
+/// <summary>
+/// timeout_awaiter races a task against a timer it holds. The task is
+/// started with the awaiting coroutine as its continuation, so finishing
+/// first resumes it directly and the timer is cancelled in await_resume;
+/// the timer firing first destroys the task and resumes it from Schedule.
+/// </summary>
+template<typename mgr_t, typename T>
+class timeout_awaiter : public Noncopyable
+{
+public:
+    using result_type = typename std::conditional<std::is_void<T>::value, bool, std::optional<T>>::type;
+
+private:
+    mgr_t& timers_;
+    Task<T> task_;
+    std::chrono::nanoseconds timeout_;
+    Timer timer_;
+    bool timed_out_{false};
+
+public:
+    timeout_awaiter(mgr_t& timers, Task<T>&& task, std::chrono::nanoseconds timeout)
+        : timers_(timers)
+        , task_(std::move(task))
+        , timeout_(timeout)
     {
-        while (!timers_.empty())
+    }
+
+    bool await_ready() const
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+    {
+        timers_.AddTimer(timer_, timeout_, [this, awaiting]() {
+            timed_out_ = true;
+            task_ = Task<T>();
+            awaiting.resume();
+        });
+        task_.GetHandle().promise().continuation_ = awaiting;
+        return task_.GetHandle();
+    }
+
+    result_type await_resume()
+    {
+        timer_.Cancel();
+        if (timed_out_)
+            return result_type();
+
+        if constexpr (std::is_void<T>::value)
         {
-            timers_.pop();
+            task_.Result();
+            return true;
+        }
+        else
+        {
+            return result_type(task_.Result());
         }
     }
 };
 
+// timer_order_test checks that a backend fires in deadline order, moves a
+// reset timer and frees a cancelled one at once.
+template<typename mgr_t>
+void timer_order_test(const char* name)
+{
+    mgr_t mgr;
+    std::vector<int> fired;
+    mgr.AddTimer(std::chrono::milliseconds(3), [&fired]() { fired.push_back(3); });
+    auto reset = mgr.AddTimer(std::chrono::milliseconds(1), [&fired]() { fired.push_back(1); });
+    auto cancelled = mgr.AddTimer(std::chrono::milliseconds(2), [&fired]() { fired.push_back(2); });
+    cancelled.Cancel();
+    mgr.Reset(reset, std::chrono::milliseconds(4));
+    while (!mgr.IsEmpty())
+    {
+        std::this_thread::sleep_for(mgr.NearLeftTime());
+        mgr.Schedule();
+    }
+    std::cout << name << " fired :";
+    for (int i : fired)
+    {
+        std::cout << " " << i;
+    }
+    std::cout << ", cancelled timer freed : " << cancelled.Expired() << std::endl;
+}
+
+// timer_periodic_test runs 10ms periodic timers on a clock that is up to
+// 4ms late every step. Deadlines stay on the 10ms grid: Skip fires at most
+// once per step and drops the periods that went by, CatchUp fires for all.
+template<typename mgr_t>
+void timer_periodic_test(const char* name)
+{
+    const auto period = std::chrono::milliseconds(10);
+    for (auto missed : {Timer::Missed::Skip, Timer::Missed::CatchUp})
+    {
+        mgr_t mgr;
+        int fired = 0;
+        auto timer = mgr.AddPeriodicTimer(period, missed, [&fired]() { fired++; });
+        const auto first = timer.Get()->GetDeadline();
+
+        auto now = first;
+        for (int step = 0; step < 1000; ++step)
+        {
+            now += period + std::chrono::microseconds(fast_rand() % 4000);
+            mgr.Schedule(now);
+        }
+        const auto drift = (timer.Get()->GetDeadline() - first) % period;
+        timer.Cancel();
+
+        std::cout << name << (missed == Timer::Missed::Skip ? " skip" : " catch up") << " : fired " << fired
+                  << " times in " << (now - first) / period + 1 << " periods, drift = " << drift.count()
+                  << "ns, cancelled : " << (timer.Expired() && mgr.IsEmpty()) << std::endl;
+    }
+}
+
+template<typename mgr_t>
+Task<int> timer_sleep_task(mgr_t& mgr, std::chrono::milliseconds sleep, int value)
+{
+    co_await mgr.SleepFor(sleep);
+    co_return value;
+}
+
+template<typename mgr_t>
+Task<void> timer_coroutine_task(mgr_t& mgr, const char* name)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 3; ++i)
+    {
+        co_await mgr.SleepFor(std::chrono::milliseconds(1));
+    }
+    const bool slept = std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(3);
+
+    std::optional<int> fast = co_await mgr.WithTimeout(timer_sleep_task(mgr, std::chrono::milliseconds(1), 1),
+        std::chrono::milliseconds(5));
+    std::optional<int> slow = co_await mgr.WithTimeout(timer_sleep_task(mgr, std::chrono::milliseconds(5), 2),
+        std::chrono::milliseconds(1));
+
+    std::cout << name << " coroutine : slept 3 x 1ms : " << slept << ", 1ms task in 5ms : "
+              << (fast ? std::to_string(*fast) : "timed out") << ", 5ms task in 1ms : "
+              << (slow ? std::to_string(*slow) : "timed out") << ", its sleep cancelled : " << mgr.IsEmpty()
+              << std::endl;
+}
+
+// timer_coroutine_test runs a coroutine that sleeps and races tasks against
+// timeouts, resumed from Schedule.
+template<typename mgr_t>
+void timer_coroutine_test(const char* name)
+{
+    mgr_t mgr;
+    Task<void> task = timer_coroutine_task(mgr, name);
+    task.Start();
+    while (!task.Done())
+    {
+        std::this_thread::sleep_for(mgr.NearLeftTime());
+        mgr.Schedule();
+    }
+}
+
 void timer_test()
 {
     std::cout << "-----------------timer_test-------------------" << std::endl;
@@ -161,4 +1236,218 @@ void timer_test()
         std::cout << "+ sleep 1 millisecond +" << std::endl;
         timerMgr.Schedule();
     }
-}
\ No newline at end of file
+
+    timer_order_test<TimerMgr>("heap");
+    timer_order_test<WheelTimerMgr>("wheel");
+    timer_periodic_test<TimerMgr>("heap");
+    timer_periodic_test<WheelTimerMgr>("wheel");
+    timer_coroutine_test<TimerMgr>("heap");
+    timer_coroutine_test<WheelTimerMgr>("wheel");
+
+    // with slack, timers a few microseconds apart share one wakeup
+    TimerMgr slackMgr;
+    slackMgr.SetSlack(std::chrono::milliseconds(1));
+    for (int i = 0; i < 10; ++i)
+    {
+        slackMgr.AddTimer(std::chrono::microseconds(1000 + i * 5), []() {});
+    }
+    while (!slackMgr.IsEmpty())
+    {
+        std::this_thread::sleep_for(slackMgr.NearLeftTime());
+        slackMgr.Schedule();
+    }
+    timer_stats stats = slackMgr.Stats();
+    std::cout << "slack 1ms : " << stats.fired_ << " timers in " << stats.wakeups_ << " wakeups, lateness p100 = "
+              << stats.lateness_.percentile(100) / 1000 << "us" << std::endl;
+}
+
+// timer_bench_run arms `count` timers with timeouts spread over a minute,
+// resets each once, as an idle timeout would be, cancels every other one,
+// then runs the rest by scheduling a simulated clock forward one
+// millisecond at a time. Last it arms `count` timers again, now from the
+// warm pool.
+template<typename mgr_t>
+void timer_bench_run(const char* name, int count)
+{
+    std::vector<Timer::Handle> handles;
+    handles.reserve(count);
+    int64_t fired = 0;
+    mgr_t mgr;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        auto timeout = std::chrono::microseconds(1000 + fast_rand() % (60 * 1000 * 1000));
+        handles.push_back(mgr.AddTimer(timeout, [&fired]() { fired++; }));
+    }
+    auto add = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        mgr.Reset(handles[i], std::chrono::microseconds(1000 + fast_rand() % (60 * 1000 * 1000)));
+    }
+    auto reset = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i += 2)
+    {
+        handles[i].Cancel();
+    }
+    auto cancel = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    auto now = start;
+    while (!mgr.IsEmpty())
+    {
+        now += std::chrono::milliseconds(1);
+        mgr.Schedule(now);
+    }
+    auto expire = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        auto timeout = std::chrono::microseconds(1000 + fast_rand() % (60 * 1000 * 1000));
+        mgr.AddTimer(timeout, [&fired]() { fired++; });
+    }
+    auto rearm = std::chrono::steady_clock::now() - start;
+    mgr.Clear();
+
+    std::cout << name << "\ttimers = " << count << "\tadd = " << add.count() / count
+              << "\treset = " << reset.count() / count << "\tcancel = " << cancel.count() / (count / 2)
+              << "\texpire = " << expire.count() / count << "\trearm = " << rearm.count() / count << "\t(fired "
+              << fired << ")" << std::endl;
+}
+
+// timer_slack_bench fires 100k timers spread over one second, a few
+// microseconds apart, with a driver that sleeps exactly until NearLeftTime,
+// and counts the wakeups the slack saves.
+template<typename mgr_t>
+void timer_slack_bench_run(const char* name, std::chrono::nanoseconds slack)
+{
+    mgr_t mgr;
+    mgr.SetSlack(slack);
+    for (int i = 0; i < 100000; ++i)
+    {
+        mgr.AddTimer(std::chrono::microseconds(fast_rand() % 1000000), []() {});
+    }
+
+    mgr.ResetStats();
+    auto now = std::chrono::steady_clock::now();
+    while (!mgr.IsEmpty())
+    {
+        now += mgr.NearLeftTime(now);
+        mgr.Schedule(now);
+    }
+    timer_stats stats = mgr.Stats();
+    std::cout << name << "\tslack = " << std::chrono::duration_cast<std::chrono::microseconds>(slack).count()
+              << "us\twakeups = " << stats.wakeups_ << "\tbatch = " << stats.batch()
+              << "\tlateness p50 = " << stats.lateness_.percentile(50) / 1000
+              << "us\tp99 = " << stats.lateness_.percentile(99) / 1000 << "us" << std::endl;
+}
+
+void timer_slack_bench()
+{
+    std::cout << "-------------------timer slack: wakeups for 100k timers in 1s---------------------" << std::endl;
+    for (auto slack : {std::chrono::microseconds(0), std::chrono::microseconds(50), std::chrono::microseconds(1000),
+             std::chrono::microseconds(5000)})
+    {
+        timer_slack_bench_run<TimerMgr>("heap", slack);
+        timer_slack_bench_run<WheelTimerMgr>("wheel", slack);
+    }
+}
+
+template<typename mgr_t>
+Task<void> timer_sleeper(mgr_t& mgr, int sleeps, int& done)
+{
+    for (int i = 0; i < sleeps; ++i)
+    {
+        co_await mgr.SleepFor(std::chrono::microseconds(1 + fast_rand() % 1000));
+    }
+    done++;
+}
+
+// timer_chain is the callback way to sleep `left_` times: each timer adds
+// the next one.
+template<typename mgr_t>
+struct timer_chain
+{
+    mgr_t* mgr_;
+    int left_;
+    int* done_;
+
+    void next()
+    {
+        if (left_-- == 0)
+        {
+            (*done_)++;
+            return;
+        }
+        mgr_->AddTimer(std::chrono::microseconds(1 + fast_rand() % 1000), [this]() { next(); });
+    }
+};
+
+// timer_coroutine_bench_run has `count` coroutines sleep 100 times each,
+// then does the same with chains of callbacks, and gives the cost of one
+// sleep: arming the timer, popping it and resuming.
+template<typename mgr_t>
+void timer_coroutine_bench_run(const char* name, int count)
+{
+    const int sleeps = 100;
+    mgr_t mgr;
+    int done = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Task<void>> tasks;
+    tasks.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        tasks.push_back(timer_sleeper(mgr, sleeps, done));
+        tasks.back().Start();
+    }
+    while (done < count)
+    {
+        mgr.Schedule(std::chrono::steady_clock::now() + std::chrono::seconds(1));
+    }
+    auto coroutine = std::chrono::steady_clock::now() - start;
+    tasks.clear();
+
+    done = 0;
+    start = std::chrono::steady_clock::now();
+    std::vector<timer_chain<mgr_t>> chains(count, timer_chain<mgr_t>{&mgr, sleeps, &done});
+    for (auto& chain : chains)
+    {
+        chain.next();
+    }
+    while (done < count)
+    {
+        mgr.Schedule(std::chrono::steady_clock::now() + std::chrono::seconds(1));
+    }
+    auto callback = std::chrono::steady_clock::now() - start;
+
+    const int64_t total = static_cast<int64_t>(count) * sleeps;
+    std::cout << name << "\tcoroutines = " << count << "\tco_await SleepFor = " << coroutine.count() / total
+              << "\tcallback AddTimer = " << callback.count() / total << std::endl;
+}
+
+void timer_coroutine_bench()
+{
+    std::cout << "-------------------timer coroutine vs callback (ns per sleep)---------------------" << std::endl;
+    for (int count : {1000, 10000, 100000})
+    {
+        timer_coroutine_bench_run<TimerMgr>("heap", count);
+        timer_coroutine_bench_run<WheelTimerMgr>("wheel", count);
+    }
+}
+
+void timer_bench()
+{
+    std::cout << "-------------------timer heap vs wheel (ns per timer)---------------------" << std::endl;
+    int counts[] = {10000, 100000, 1000000, 10000000};
+    for (int count : counts)
+    {
+        timer_bench_run<TimerMgr>("heap", count);
+        timer_bench_run<WheelTimerMgr>("wheel", count);
+    }
+}
@@ -0,0 +1,482 @@
+#pragma once
+
+#include "head.hpp"
+#include "bench.hpp"
+#include "mpsc_queue.hpp"
+#include "timer.hpp"
+
+#include <future>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/// <summary>
+/// BasicTimerService runs a BasicTimerMgr on its own dispatcher thread, which
+/// sleeps in epoll until the earliest deadline (a timerfd armed at it) or
+/// until another thread wakes it (an eventfd). Any thread can add, reset
+/// and cancel timers: requests go through a lock-free MPSC queue and the
+/// dispatcher applies them when it wakes. A producer only signals the
+/// eventfd when its request moves the earliest deadline forward, so adding
+/// a timer usually costs no system call. Callbacks run on the dispatcher
+/// thread.
+/// </summary>
+template<typename queue_t>
+class BasicTimerService : public Noncopyable
+{
+public:
+    // TimerId names a timer across threads, 0 is never used.
+    using TimerId = uint64_t;
+
+private:
+    struct command : mpsc_node
+    {
+        enum kind
+        {
+            add,
+            reset,
+            cancel,
+            slack,
+            stop
+        };
+
+        kind kind_;
+        TimerId id_{0};
+        std::chrono::steady_clock::time_point deadline_; // add, reset
+        std::chrono::nanoseconds period_{0};             // add, zero for one-shot
+        std::chrono::nanoseconds slack_{0};              // slack
+        Timer::Missed missed_{Timer::Missed::Skip};
+        Timer::Callback callback_;
+    };
+
+    static const int64_t awake = 0; // wake_at_ while the dispatcher runs
+
+    BasicTimerMgr<queue_t> timers_;                  // dispatcher thread only
+    std::unordered_map<TimerId, Timer::Handle> ids_; // dispatcher thread only
+    std::size_t purge_at_{1024};
+    mpsc_queue<command> commands_;
+    std::atomic<TimerId> next_id_{1};
+    std::atomic<int64_t> wake_at_{awake}; // steady_clock ns the dispatcher sleeps until
+    std::atomic<bool> stopped_{false};
+    int epoll_fd_{-1};
+    int event_fd_{-1};
+    int timer_fd_{-1};
+    std::thread dispatcher_;
+    std::mutex join_mutex_; // Stop from several threads joins once
+
+public:
+    template<typename... TQueueArgs>
+    explicit BasicTimerService(TQueueArgs&&... args)
+        : timers_(std::forward<TQueueArgs>(args)...)
+    {
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epoll_fd_ < 0 || event_fd_ < 0 || timer_fd_ < 0 || !watch(event_fd_) || !watch(timer_fd_))
+        {
+            close_fds();
+            throw std::runtime_error("BasicTimerService: cannot create epoll, eventfd or timerfd");
+        }
+
+        dispatcher_ = std::thread([this]() { run(); });
+    }
+
+    ~BasicTimerService()
+    {
+        Stop();
+        while (command* cmd = commands_.pop())
+        {
+            delete cmd;
+        }
+        close_fds();
+    }
+
+    template<typename F, typename... TArgs>
+    TimerId AddTimer(std::chrono::nanoseconds timeout, F&& callback, TArgs&&... args)
+    {
+        command* cmd = new command;
+        cmd->kind_ = command::add;
+        cmd->deadline_ = std::chrono::steady_clock::now() + timeout;
+        cmd->callback_ = make_timer_callback(std::forward<F>(callback), std::forward<TArgs>(args)...);
+        return submit(cmd);
+    }
+
+    template<typename F, typename... TArgs>
+    TimerId AddPeriodicTimer(std::chrono::nanoseconds period, Timer::Missed missed, F&& callback, TArgs&&... args)
+    {
+        if (period <= std::chrono::nanoseconds::zero())
+            throw std::invalid_argument("AddPeriodicTimer: period must be positive");
+
+        command* cmd = new command;
+        cmd->kind_ = command::add;
+        cmd->deadline_ = std::chrono::steady_clock::now() + period;
+        cmd->period_ = period;
+        cmd->missed_ = missed;
+        cmd->callback_ = make_timer_callback(std::forward<F>(callback), std::forward<TArgs>(args)...);
+        return submit(cmd);
+    }
+
+    // Reset restarts a timer with a new timeout from now, if it has not
+    // fired or been cancelled by the time the dispatcher gets to it.
+    void Reset(TimerId id, std::chrono::nanoseconds timeout)
+    {
+        command* cmd = new command;
+        cmd->kind_ = command::reset;
+        cmd->deadline_ = std::chrono::steady_clock::now() + timeout;
+        submit(cmd, id);
+    }
+
+    // Cancel cancels a timer unless it fires first. The dispatcher is not
+    // woken for it: the timer goes at its next wakeup.
+    void Cancel(TimerId id)
+    {
+        command* cmd = new command;
+        cmd->kind_ = command::cancel;
+        submit(cmd, id);
+    }
+
+    // SetSlack sets the slack of the timers added after it, see
+    // BasicTimerMgr::SetSlack.
+    void SetSlack(std::chrono::nanoseconds slack)
+    {
+        command* cmd = new command;
+        cmd->kind_ = command::slack;
+        cmd->slack_ = slack;
+        submit(cmd);
+    }
+
+    // Stats counts the dispatcher's wakeups and how late timers fired.
+    timer_stats Stats() const
+    {
+        return timers_.Stats();
+    }
+
+    // Stop joins the dispatcher. Timers still pending never fire. Called
+    // from a callback, on the dispatcher thread, it only asks the dispatcher
+    // to stop once the callbacks due now have run; the destructor, or a
+    // Stop from another thread, joins it. The service must not be
+    // destroyed from a callback.
+    void Stop()
+    {
+        if (!stopped_.exchange(true))
+        {
+            command* cmd = new command;
+            cmd->kind_ = command::stop;
+            submit(cmd);
+        }
+        if (std::this_thread::get_id() == dispatcher_.get_id())
+            return;
+
+        std::lock_guard<std::mutex> lock(join_mutex_);
+        if (dispatcher_.joinable())
+            dispatcher_.join();
+    }
+
+private:
+    static int64_t ticks(std::chrono::steady_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    bool watch(int fd)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        return ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    void close_fds()
+    {
+        for (int fd : {epoll_fd_, event_fd_, timer_fd_})
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+        epoll_fd_ = event_fd_ = timer_fd_ = -1;
+    }
+
+    TimerId submit(command* cmd, TimerId id = 0)
+    {
+        cmd->id_ = id != 0 ? id : next_id_.fetch_add(1, std::memory_order_relaxed);
+        id = cmd->id_;
+        const bool stop = cmd->kind_ == command::stop;
+        const bool earlier = cmd->kind_ == command::add || cmd->kind_ == command::reset;
+        const int64_t deadline = earlier ? ticks(cmd->deadline_) : 0;
+
+        // cmd may be gone once pushed. Pairs with run(): either the
+        // dispatcher sees the command before it sleeps or we see the
+        // deadline it sleeps until.
+        commands_.push(cmd);
+        const int64_t wake_at = wake_at_.load(std::memory_order_seq_cst);
+        if (stop || (earlier && wake_at != awake && deadline < wake_at))
+        {
+            const uint64_t one = 1;
+            ssize_t written = ::write(event_fd_, &one, sizeof(one));
+            (void)written; // EAGAIN only if the counter is full, a wakeup is pending anyway
+        }
+        return id;
+    }
+
+    void run()
+    {
+        epoll_event events[2];
+        while (true)
+        {
+            wake_at_.store(awake, std::memory_order_seq_cst);
+            if (!drain())
+                break;
+
+            timers_.Schedule();
+
+            const auto now = std::chrono::steady_clock::now();
+            const int64_t wake_at =
+                timers_.IsEmpty() ? std::numeric_limits<int64_t>::max() : ticks(now + timers_.NearLeftTime(now));
+            wake_at_.store(wake_at, std::memory_order_seq_cst);
+            if (!commands_.empty())
+                continue;
+
+            arm(wake_at);
+            if (::epoll_wait(epoll_fd_, events, 2, -1) < 0)
+                continue; // EINTR
+
+            uint64_t count;
+            ssize_t got = ::read(event_fd_, &count, sizeof(count));
+            got = ::read(timer_fd_, &count, sizeof(count));
+            (void)got; // EAGAIN for the one that did not fire
+        }
+    }
+
+    // arm sets the timerfd to go off at `wake_at`, or disarms it.
+    void arm(int64_t wake_at)
+    {
+        itimerspec spec{};
+        if (wake_at != std::numeric_limits<int64_t>::max())
+        {
+            spec.it_value.tv_sec = static_cast<time_t>(wake_at / 1000000000);
+            spec.it_value.tv_nsec = static_cast<long>(wake_at % 1000000000);
+            if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+                spec.it_value.tv_nsec = 1; // zero would disarm
+        }
+        ::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    // drain applies the queued requests; it returns false on stop.
+    bool drain()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        bool running = true;
+        while (command* cmd = commands_.pop())
+        {
+            running = running && apply(*cmd, now);
+            delete cmd;
+        }
+        return running;
+    }
+
+    bool apply(command& cmd, std::chrono::steady_clock::time_point now)
+    {
+        switch (cmd.kind_)
+        {
+        case command::add:
+        {
+            // the first deadline was fixed at submit time, so queueing does
+            // not delay a periodic timer's whole schedule
+            Timer::Handle handle =
+                cmd.period_ == std::chrono::nanoseconds::zero()
+                    ? timers_.AddTimer(cmd.deadline_ - now, std::move(cmd.callback_))
+                    : timers_.AddPeriodicTimer(cmd.deadline_ - now, cmd.period_, cmd.missed_, std::move(cmd.callback_));
+            ids_.emplace(cmd.id_, handle);
+            purge();
+            break;
+        }
+        case command::reset:
+        {
+            auto iter = ids_.find(cmd.id_);
+            if (iter != ids_.end())
+                timers_.Reset(iter->second, cmd.deadline_ - now, now);
+            break;
+        }
+        case command::cancel:
+        {
+            auto iter = ids_.find(cmd.id_);
+            if (iter != ids_.end())
+            {
+                iter->second.Cancel();
+                ids_.erase(iter);
+            }
+            break;
+        }
+        case command::slack:
+            timers_.SetSlack(cmd.slack_);
+            break;
+        case command::stop:
+            timers_.Clear();
+            return false;
+        }
+        return true;
+    }
+
+    // purge drops the ids of fired timers once they make up half the map.
+    void purge()
+    {
+        if (ids_.size() < purge_at_)
+            return;
+
+        for (auto iter = ids_.begin(); iter != ids_.end();)
+        {
+            iter = iter->second.Expired() ? ids_.erase(iter) : std::next(iter);
+        }
+        purge_at_ = std::max<std::size_t>(1024, ids_.size() * 2);
+    }
+};
+
+template<typename queue_t>
+const int64_t BasicTimerService<queue_t>::awake;
+
+using TimerService = BasicTimerService<heap_timer_queue>;
+using WheelTimerService = BasicTimerService<wheel_timer_queue>;
+
+// timer_service_lateness arms `count` timers per thread from `threads`
+// threads, timeouts up to `spread`, cancels one in ten and returns how late
+// the fired ones were, in microseconds.
+template<typename service_t>
+std::vector<int64_t> timer_service_lateness(int threads, int count, std::chrono::milliseconds spread)
+{
+    std::vector<int64_t> lateness(static_cast<std::size_t>(threads) * count, -1);
+    {
+        service_t service;
+        run_threads(threads, [&](int index) {
+            for (int i = 0; i < count; ++i)
+            {
+                const auto timeout = std::chrono::microseconds(fast_rand() % (spread.count() * 1000));
+                const auto deadline = std::chrono::steady_clock::now() + timeout;
+                int64_t* slot = &lateness[static_cast<std::size_t>(index) * count + i];
+                auto id = service.AddTimer(timeout, [slot, deadline]() {
+                    auto late = std::chrono::steady_clock::now() - deadline;
+                    *slot = std::chrono::duration_cast<std::chrono::microseconds>(late).count();
+                });
+                if (i % 10 == 0)
+                    service.Cancel(id);
+            }
+        });
+        std::this_thread::sleep_for(spread + std::chrono::milliseconds(100));
+    }
+    lateness.erase(std::remove(lateness.begin(), lateness.end(), -1), lateness.end());
+    return lateness;
+}
+
+void timer_service_test()
+{
+    std::cout << "-----------------timer_service_test-------------------" << std::endl;
+
+    TimerService service;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<int> fired;
+    auto add = [&](int order, int ms) {
+        return service.AddTimer(std::chrono::milliseconds(ms), [&, order]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            fired.push_back(order);
+            cv.notify_one();
+        });
+    };
+    add(3, 30);
+    add(1, 10);
+    service.Cancel(add(0, 5));
+    service.Reset(add(2, 1), std::chrono::milliseconds(20));
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&fired]() { return fired.size() == 3; });
+    }
+    std::cout << "fired :";
+    for (int i : fired)
+    {
+        std::cout << " " << i;
+    }
+    std::cout << std::endl;
+
+    // a periodic timer added while the dispatcher is busy keeps its first
+    // deadline, and its callback can stop the service
+    TimerService busy;
+    busy.AddTimer(std::chrono::milliseconds(0), []() { std::this_thread::sleep_for(std::chrono::milliseconds(100)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::promise<std::chrono::steady_clock::time_point> first;
+    const auto submitted = std::chrono::steady_clock::now();
+    busy.AddPeriodicTimer(std::chrono::milliseconds(100), Timer::Missed::Skip, [&busy, &first]() {
+        first.set_value(std::chrono::steady_clock::now());
+        busy.Stop();
+    });
+    const auto first_delay = first.get_future().get() - submitted;
+    busy.Stop();
+    std::cout << "periodic first deadline kept : " << (first_delay < std::chrono::milliseconds(140))
+              << ", stopped from its callback" << std::endl;
+
+    auto lateness = timer_service_lateness<TimerService>(4, 250, std::chrono::milliseconds(20));
+    std::cout << "4 threads, " << lateness.size() << " timers fired, lateness p50 = " << percentile(lateness, 50)
+              << "us, p99 = " << percentile(lateness, 99) << "us" << std::endl;
+}
+
+// timer_service_bench arms timers from 1..4 threads and reports the add
+// rate and the firing lateness, against a TimerMgr polled every 1ms.
+void timer_service_bench()
+{
+    std::cout << "-------------------timer service: add rate and lateness---------------------" << std::endl;
+    for (int threads : {1, 2, 4})
+    {
+        const int count = 100000;
+        int64_t added = 0;
+        std::chrono::nanoseconds elapsed{0};
+        {
+            TimerService service;
+            elapsed = run_threads(threads, [&service](int) {
+                for (int i = 0; i < count; ++i)
+                {
+                    service.AddTimer(std::chrono::milliseconds(1 + fast_rand() % 100), []() {});
+                }
+            });
+            added = static_cast<int64_t>(threads) * count;
+        }
+        auto lateness = timer_service_lateness<TimerService>(threads, 2000, std::chrono::milliseconds(50));
+        std::cout << "threads = " << threads << "\tadd = " << mops(added, elapsed) << " Mops/s\tlateness p50 = "
+                  << percentile(lateness, 50) << "us\tp99 = " << percentile(lateness, 99) << "us" << std::endl;
+    }
+
+    // slack: 20k timers over 200ms, a few microseconds apart
+    for (auto slack : {std::chrono::microseconds(0), std::chrono::microseconds(50), std::chrono::microseconds(1000)})
+    {
+        TimerService service;
+        service.SetSlack(slack);
+        for (int i = 0; i < 20000; ++i)
+        {
+            service.AddTimer(std::chrono::microseconds(fast_rand() % 200000), []() {});
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        timer_stats stats = service.Stats();
+        std::cout << "slack = " << slack.count() << "us\twakeups/s = " << static_cast<int64_t>(stats.wakeups_per_second())
+                  << "\tbatch = " << stats.batch() << "\tlateness p50 = " << stats.lateness_.percentile(50) / 1000
+                  << "us\tp99 = " << stats.lateness_.percentile(99) / 1000 << "us" << std::endl;
+    }
+
+    // the old way: Schedule from a sleep_for(1ms) loop
+    TimerMgr mgr;
+    std::vector<int64_t> lateness;
+    for (int i = 0; i < 2000; ++i)
+    {
+        const auto timeout = std::chrono::microseconds(fast_rand() % 50000);
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        mgr.AddTimer(timeout, [&lateness, deadline]() {
+            lateness.push_back(
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - deadline)
+                    .count());
+        });
+    }
+    while (!mgr.IsEmpty())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        mgr.Schedule();
+    }
+    std::cout << "sleep(1ms) polling\t\t\tlateness p50 = " << percentile(lateness, 50)
+              << "us\tp99 = " << percentile(lateness, 99) << "us" << std::endl;
+}
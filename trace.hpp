@@ -0,0 +1,132 @@
+#pragma once
+
+#include "head.hpp"
+
+#include <cmath>
+#include <fstream>
+#include <random>
+
+// Access traces for hit-ratio comparisons between cache configurations. A
+// trace is a sequence of integer keys; recorded traces are read from a text
+// file with one key per line (whitespace separated), synthetic ones model
+// the usual shapes: skewed popularity, loops larger than the cache and
+// one-off scans.
+using trace_t = std::vector<int>;
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+// load_trace reads a recorded trace, returns an empty trace on failure.
+trace_t load_trace(const std::string& path)
+{
+    trace_t trace;
+    std::ifstream in(path);
+    int key = 0;
+    while (in >> key)
+    {
+        trace.push_back(key);
+    }
+    return trace;
+}
+
+// zipf_trace draws `length` keys from [0, keys) where the popularity of the
+// i-th key is proportional to 1 / (i + 1)^s.
+trace_t zipf_trace(int keys, int length, double s, uint32_t seed = 1)
+{
+    std::vector<double> cdf(keys);
+    double sum = 0;
+    for (int i = 0; i < keys; ++i)
+    {
+        sum += 1.0 / std::pow(i + 1, s);
+        cdf[i] = sum;
+    }
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> dist(0, sum);
+    trace_t trace;
+    trace.reserve(length);
+    for (int i = 0; i < length; ++i)
+    {
+        auto pos = std::lower_bound(cdf.begin(), cdf.end(), dist(gen)) - cdf.begin();
+        // scatter the popular keys over the key space
+        trace.push_back(static_cast<int>(mix_hash(pos) & 0x3FFFFFFF));
+    }
+    return trace;
+}
+
+// loop_trace cycles over `keys` distinct keys, the worst case for LRU when
+// keys exceeds the capacity.
+trace_t loop_trace(int keys, int length)
+{
+    trace_t trace;
+    trace.reserve(length);
+    for (int i = 0; i < length; ++i)
+    {
+        trace.push_back(i % keys);
+    }
+    return trace;
+}
+
+// scan_trace is a zipf workload interrupted every `period` accesses by a
+// sequential scan of `scan_length` keys that are never touched again.
+trace_t scan_trace(int keys, int length, int period, int scan_length, uint32_t seed = 1)
+{
+    trace_t hot = zipf_trace(keys, length, 0.9, seed);
+    trace_t trace;
+    trace.reserve(length + length / period * scan_length);
+    int cold = 0x40000000;
+    for (int i = 0; i < length; ++i)
+    {
+        if (i > 0 && i % period == 0)
+        {
+            for (int j = 0; j < scan_length; ++j)
+            {
+                trace.push_back(cold++);
+            }
+        }
+        trace.push_back(hot[i]);
+    }
+    return trace;
+}
+
+// replay feeds a trace through a cache (Get, Set on miss) and returns the
+// hit ratio.
+template<typename cache_t>
+double replay(cache_t& cache, const trace_t& trace)
+{
+    int64_t hits = 0;
+    int value = 0;
+    for (int key : trace)
+    {
+        if (cache.Get(key, value))
+        {
+            hits++;
+        }
+        else
+        {
+            cache.Set(key, key);
+        }
+    }
+    return trace.empty() ? 0 : static_cast<double>(hits) / trace.size();
+}
+
+struct named_trace
+{
+    std::string name_;
+    trace_t keys_;
+};
+
+// bench_traces is the standard trace set for hit-ratio benchmarks, plus the
+// recorded trace at `recorded_path` if one is given.
+std::vector<named_trace> bench_traces(const std::string& recorded_path)
+{
+    std::vector<named_trace> traces;
+    traces.push_back({"zipf 0.8", zipf_trace(100000, 1000000, 0.8)});
+    traces.push_back({"zipf 0.99", zipf_trace(100000, 1000000, 0.99)});
+    traces.push_back({"loop", loop_trace(1200, 1000000)});
+    traces.push_back({"zipf + scans", scan_trace(100000, 1000000, 20000, 5000)});
+    if (!recorded_path.empty())
+    {
+        traces.push_back({recorded_path, load_trace(recorded_path)});
+    }
+    return traces;
+}
@@ -1,28 +1,155 @@
 #pragma once
 
 #include "head.hpp"
+#include "bench.hpp"
 #include "singleton.hpp"
 
-class WaitGroup : public SingleTon<WaitGroup>
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// futex_wait sleeps while *word == expected, until woken, for at most
+// `timeout` if not null. It may return early, so callers check again.
+inline void futex_wait(std::atomic<int>& word, int expected, const timespec* timeout)
+{
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex word must be a plain int");
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+// futex_wake wakes up to `count` threads sleeping on word.
+inline void futex_wake(std::atomic<int>& word, int count = INT_MAX)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+/// <summary>
+/// WaitGroup waits for a group of tasks, like Go's sync.WaitGroup: Add the
+/// task count, Done once per task, Wait until the count reaches zero. It is
+/// a plain value, one atomic word holding the count and a "someone sleeps"
+/// bit, so it can live on the stack of the thread that waits. Done is one
+/// atomic add and makes a system call only on the last task of a group with
+/// a sleeping waiter; Wait spins a little before sleeping on a futex. The
+/// group can be reused once every Wait has returned.
+/// </summary>
+class WaitGroup : public Noncopyable
+{
+private:
+    static const int waiting = 1;
+
+    std::atomic<int> state_{0}; // count << 1 | waiting
+
+public:
+    WaitGroup() = default;
+
+    void Add(int i = 1)
+    {
+        const int prev = state_.fetch_add(i * 2, std::memory_order_acq_rel);
+        const int next = prev + i * 2;
+        if ((next & waiting) != 0 && (prev >> 1) > 0 && (next >> 1) <= 0)
+            futex_wake(state_);
+    }
+
+    void Done()
+    {
+        Add(-1);
+    }
+
+    // Count returns the tasks not done yet.
+    int Count() const
+    {
+        return state_.load(std::memory_order_acquire) >> 1;
+    }
+
+    void Wait()
+    {
+        wait(nullptr);
+    }
+
+    // Wait returns false if the tasks are not done within `timeout`.
+    template<class Rep, class Period>
+    bool Wait(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait(&deadline);
+    }
+
+private:
+    // spins is how long Wait polls before sleeping; on a single CPU the
+    // tasks cannot progress while it polls, so it does not.
+    static int spins()
+    {
+        static const int count = std::thread::hardware_concurrency() > 1 ? 64 : 0;
+        return count;
+    }
+
+    bool wait(const std::chrono::steady_clock::time_point* deadline)
+    {
+        for (int i = spins(); i > 0; --i)
+        {
+            if (Count() <= 0)
+                return true;
+            cpu_relax();
+        }
+
+        int state = state_.load(std::memory_order_acquire);
+        while ((state >> 1) > 0)
+        {
+            if ((state & waiting) == 0 &&
+                !state_.compare_exchange_weak(state, state | waiting, std::memory_order_acquire))
+                continue;
+
+            timespec left;
+            if (deadline != nullptr)
+            {
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    *deadline - std::chrono::steady_clock::now()).count();
+                if (ns <= 0)
+                    return false;
+                left.tv_sec = static_cast<time_t>(ns / 1000000000);
+                left.tv_nsec = static_cast<long>(ns % 1000000000);
+            }
+            futex_wait(state_, state | waiting, deadline != nullptr ? &left : nullptr);
+            state = state_.load(std::memory_order_acquire);
+        }
+
+        // every sleeper was woken when the count reached zero and none can
+        // sleep again before the next Add, so the bit can go
+        if ((state & waiting) != 0)
+            state_.fetch_and(~waiting, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+const int WaitGroup::waiting;
+
+/// <summary>
+/// CondWaitGroup is the first WaitGroup, kept for comparison: a shared
+/// singleton-style object made through Create, whose Done notifies a
+/// condition variable on every call, outside the mutex, so a Wait can miss
+/// the last one and only leave on its timeout.
+/// </summary>
+class CondWaitGroup : public SingleTon<CondWaitGroup>
 {
 private:
     std::mutex mutex_;
     std::atomic<int> counter_;
     std::condition_variable cond_;
 
-    WaitGroup()
+    CondWaitGroup()
         : counter_(0)
     {
     }
 
-    virtual ~WaitGroup() = default;
+    virtual ~CondWaitGroup() = default;
 
 public:
-    using Ptr = std::shared_ptr<WaitGroup>;
+    using Ptr = std::shared_ptr<CondWaitGroup>;
 
     static Ptr Create()
     {
-        struct make_shared_enabler : public WaitGroup
+        struct make_shared_enabler : public CondWaitGroup
         {
         };
         return std::make_shared<make_shared_enabler>();
@@ -46,18 +173,18 @@ public:
     }
 
     template<class Rep, class Period>
-    void Wait(const std::chrono::duration<Rep, Period>& timeout)
+    bool Wait(const std::chrono::duration<Rep, Period>& timeout)
     {
         std::unique_lock<std::mutex> l(mutex_);
-        cond_.wait_for(l, timeout, [&] { return counter_ <= 0; });
+        return cond_.wait_for(l, timeout, [&] { return counter_ <= 0; });
     }
 };
 
-void work(int i, WaitGroup::Ptr wg)
+void work(int i, WaitGroup& wg)
 {
     std::this_thread::sleep_for(std::chrono::seconds(i + 1));
     std::cout << "worker-" << i << " done the job" << std::endl;
-    wg->Done();
+    wg.Done();
 }
 
 void wait_group_test()
@@ -65,21 +192,97 @@ void wait_group_test()
     std::cout << "-----------------wait_group_test-------------------" << std::endl;
 
     int count = 10;
-    WaitGroup::Ptr wg = WaitGroup::Create();
+    WaitGroup wg;
 
-    wg->Add(count);
+    wg.Add(count);
 
     std::thread threads[10];
     for (int i = 0; i < count; ++i)
-        threads[i] = std::thread(std::bind(std::forward<std::function<void(int, WaitGroup::Ptr)>>(work), i, wg));
+        threads[i] = std::thread(work, i, std::ref(wg));
 
     std::cout << "start to work" << std::endl;
     std::this_thread::sleep_for(std::chrono::seconds(1));
 
-    for (auto& th : threads)
-        th.detach();
-
     std::cout << "wait for all workers!" << std::endl;
-    wg->Wait();
+    wg.Wait();
     std::cout << "all work finished!" << std::endl;
-}
\ No newline at end of file
+
+    for (auto& th : threads)
+        th.join();
+}
+
+// wait_group_round waits for one round of tasks. CondWaitGroup is waited
+// on in 10ms slices, so a lost wakeup costs a slice instead of hanging.
+inline void wait_group_round(WaitGroup& wg)
+{
+    wg.Wait();
+}
+
+inline void wait_group_round(CondWaitGroup& wg)
+{
+    while (!wg.Wait(std::chrono::milliseconds(10)))
+    {
+    }
+}
+
+// wait_group_bench_run fans rounds of `tasks` empty tasks out to `threads`
+// workers that claim them from a shared counter, and waits for each round
+// on the group: the cost of Add, Done and Wait per task and per round.
+template<typename group_t>
+void wait_group_bench_run(const char* name, group_t& wg, int threads, int tasks)
+{
+    const int rounds = std::max(20, 200000 / tasks);
+    std::atomic<int> claims{0};
+    std::atomic<bool> stop{false};
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&]() {
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                if (claims.load(std::memory_order_relaxed) <= 0 || claims.fetch_sub(1) <= 0)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                wg.Done();
+            }
+        });
+    }
+
+    std::vector<int64_t> samples;
+    samples.reserve(rounds);
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+    {
+        const auto round_start = std::chrono::steady_clock::now();
+        wg.Add(tasks);
+        claims.store(tasks);
+        wait_group_round(wg);
+        samples.push_back((std::chrono::steady_clock::now() - round_start).count());
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    stop.store(true);
+    for (auto& worker : workers)
+        worker.join();
+
+    std::cout << name << "\ttasks = " << tasks << "\tns per task = " << elapsed.count() / (int64_t(rounds) * tasks)
+              << "\tround p50 = " << percentile(samples, 50) / 1000 << "us\tp99 = " << percentile(samples, 99) / 1000
+              << "us" << std::endl;
+}
+
+void wait_group_bench()
+{
+    const int threads = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+    std::cout << "-------------------wait group: futex vs condition variable, " << threads
+              << " workers---------------------" << std::endl;
+    for (int tasks : {1, 10, 100, 1000, 10000, 100000})
+    {
+        WaitGroup wg;
+        wait_group_bench_run("futex", wg, threads, tasks);
+        CondWaitGroup::Ptr cond = CondWaitGroup::Create();
+        wait_group_bench_run("condvar", *cond, threads, tasks);
+    }
+}